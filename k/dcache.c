@@ -0,0 +1,93 @@
+#include "dcache.h"
+
+#include <k/compiler.h>
+#include <string.h>
+
+/*
+ * Resolved paths, hashed on the full path so that a repeated open() costs a
+ * single bucket probe instead of directory block reads. Missing files are
+ * cached as negative entries. When every entry is in use the least recently
+ * used one is recycled.
+ */
+
+static struct dentry dentries[DCACHE_ENTRIES];
+static struct list buckets[DCACHE_BUCKETS];
+static struct list lru = {&lru, &lru};
+static int dcache_ready;
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+u32 dcache_hash(const char *path) {
+  u32 hash = FNV_OFFSET_BASIS;
+
+  for (; *path; ++path) {
+    hash ^= (u8)*path;
+    hash *= FNV_PRIME;
+  }
+
+  return hash;
+}
+
+void dcache_flush(void) {
+  list_init(&lru);
+
+  for (size_t i = 0; i < array_size(buckets); ++i)
+    list_init(&buckets[i]);
+
+  /* unused entries sit at the tail of the lru, off any bucket */
+  for (size_t i = 0; i < array_size(dentries); ++i) {
+    list_init(&dentries[i].hash_list);
+    list_insert(lru.prev, &dentries[i].lru);
+  }
+
+  dcache_ready = 1;
+}
+
+static struct list *dcache_bucket(u32 hash) {
+  return &buckets[hash & (array_size(buckets) - 1)];
+}
+
+struct dentry *dcache_lookup(const char *path, u32 hash) {
+  if (!dcache_ready)
+    return NULL;
+
+  struct list *bucket = dcache_bucket(hash);
+  struct dentry *d;
+
+  list_for_each(d, bucket, hash_list) {
+    if (d->hash != hash || strcmp(d->path, path))
+      continue;
+
+    list_remove(&d->lru);
+    list_insert(&lru, &d->lru);
+    return d;
+  }
+
+  return NULL;
+}
+
+void dcache_insert(const char *path, u32 hash, const struct inode *inode) {
+  size_t len = strlen(path);
+
+  if (len >= DCACHE_PATH_SZ)
+    return;
+
+  if (!dcache_ready)
+    dcache_flush();
+
+  struct dentry *d = container_of(lru.prev, struct dentry, lru);
+
+  list_remove(&d->lru);
+  list_insert(&lru, &d->lru);
+
+  if (!list_empty(&d->hash_list))
+    list_remove(&d->hash_list);
+  list_insert(dcache_bucket(hash), &d->hash_list);
+
+  d->hash = hash;
+  d->negative = !inode;
+  if (inode)
+    d->inode = *inode;
+  memcpy(d->path, path, len + 1);
+}
@@ -0,0 +1,25 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include "list.h"
+#include "vfs.h"
+
+#define DCACHE_BUCKETS 64
+#define DCACHE_ENTRIES 256
+#define DCACHE_PATH_SZ 64
+
+struct dentry {
+  struct list hash_list;
+  struct list lru;
+  u32 hash;
+  int negative; /* the path is known not to exist */
+  struct inode inode;
+  char path[DCACHE_PATH_SZ];
+};
+
+u32 dcache_hash(const char *path);
+struct dentry *dcache_lookup(const char *path, u32 hash);
+void dcache_insert(const char *path, u32 hash, const struct inode *inode);
+void dcache_flush(void);
+
+#endif /* DCACHE_H */
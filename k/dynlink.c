@@ -0,0 +1,445 @@
+#include "dynlink.h"
+
+#include <k/compiler.h>
+#include <string.h>
+
+#include "memory.h"
+#include "pcache.h"
+
+/*
+ * Minimal dynamic linker. A rom may be linked against the shared libk
+ * instead of embedding libk and libc: the library is loaded once, anywhere
+ * since it is position independent, and stays there, its text shared by
+ * every rom. Its writable segment is part of the state of the running rom:
+ * it is reset before a rom is linked and saved along with the rom when it
+ * is suspended. Every relocation is applied when a rom is loaded, there is
+ * no lazy binding, and symbols are looked up in the rom then the library.
+ */
+
+static struct shlib libs[DYNLINK_LIB_MAX];
+
+static int dso_contains(const struct dso *dso, u32 addr, u32 size) {
+  return addr >= dso->start && addr <= dso->end && size <= dso->end - addr;
+}
+
+static int dso_check_rel(const struct dso *dso, u32 addr, u32 size) {
+  if (!size)
+    return 1;
+
+  return !(size % sizeof(Elf32_Rel)) && dso_contains(dso, addr, size);
+}
+
+/* fill in a dso from its dynamic section, checking what it points to */
+static int dso_parse(struct dso *dso, u32 dynamic) {
+  u32 hash = 0, symtab = 0, strtab = 0;
+  u32 rel = 0, relsz = 0, jmprel = 0, pltrelsz = 0;
+  int needed_cnt = 0;
+
+  for (const Elf32_Dyn *dyn = (const Elf32_Dyn *)dynamic;; ++dyn) {
+    if (!dso_contains(dso, (u32)dyn, sizeof(*dyn)))
+      return -EINVAL;
+    if (dyn->d_tag == DT_NULL)
+      break;
+
+    u32 val = dyn->d_un.d_val;
+    switch (dyn->d_tag) {
+    case DT_NEEDED:
+      dso->needed = val;
+      ++needed_cnt;
+      break;
+    case DT_HASH:
+      hash = dso->base + val;
+      break;
+    case DT_STRTAB:
+      strtab = dso->base + val;
+      break;
+    case DT_STRSZ:
+      dso->strsz = val;
+      break;
+    case DT_SYMTAB:
+      symtab = dso->base + val;
+      break;
+    case DT_REL:
+      rel = dso->base + val;
+      break;
+    case DT_RELSZ:
+      relsz = val;
+      break;
+    case DT_JMPREL:
+      jmprel = dso->base + val;
+      break;
+    case DT_PLTRELSZ:
+      pltrelsz = val;
+      break;
+    case DT_SYMENT:
+      if (val != sizeof(Elf32_Sym))
+        return -EINVAL;
+      break;
+    case DT_RELENT:
+      if (val != sizeof(Elf32_Rel))
+        return -EINVAL;
+      break;
+    case DT_PLTREL:
+      if (val != DT_REL)
+        return -EINVAL;
+      break;
+    case DT_RELA:
+      return -EINVAL;
+    }
+  }
+
+  /* one library, which needs none */
+  if (needed_cnt > 1)
+    return -EINVAL;
+
+  u32 size = dso->end - dso->start;
+  if (!dso_contains(dso, hash, 2 * sizeof(u32)))
+    return -EINVAL;
+  dso->hash = (const u32 *)hash;
+  if (dso->hash[0] > size || dso->hash[1] > size ||
+      !dso_contains(dso, hash, (2 + dso->hash[0] + dso->hash[1]) * 4))
+    return -EINVAL;
+
+  dso->sym_cnt = dso->hash[1];
+  if (!dso_contains(dso, symtab, dso->sym_cnt * sizeof(Elf32_Sym)))
+    return -EINVAL;
+  dso->symtab = (const Elf32_Sym *)symtab;
+
+  if (!dso->strsz || !dso_contains(dso, strtab, dso->strsz))
+    return -EINVAL;
+  dso->strtab = (const char *)strtab;
+  if (dso->strtab[dso->strsz - 1] || dso->needed >= dso->strsz)
+    return -EINVAL;
+
+  if (!dso_check_rel(dso, rel, relsz) ||
+      !dso_check_rel(dso, jmprel, pltrelsz))
+    return -EINVAL;
+  dso->rel = (const Elf32_Rel *)rel;
+  dso->rel_cnt = relsz / sizeof(Elf32_Rel);
+  dso->jmprel = (const Elf32_Rel *)jmprel;
+  dso->jmprel_cnt = pltrelsz / sizeof(Elf32_Rel);
+
+  return 0;
+}
+
+static u32 dso_hash(const char *name) {
+  u32 h = 0;
+
+  for (; *name; ++name) {
+    h = (h << 4) + (u8)*name;
+    u32 g = h & 0xf0000000;
+    if (g)
+      h ^= g >> 24;
+    h &= ~g;
+  }
+
+  return h;
+}
+
+static u32 dso_sym_addr(const struct dso *dso, const Elf32_Sym *sym) {
+  return sym->st_shndx == SHN_ABS ? sym->st_value : dso->base + sym->st_value;
+}
+
+/* a symbol defined by a dso, through its SysV hash table */
+static const Elf32_Sym *dso_lookup(const struct dso *dso, const char *name) {
+  u32 nbucket = dso->hash[0];
+  const u32 *bucket = dso->hash + 2;
+  const u32 *chain = bucket + nbucket;
+
+  if (!nbucket)
+    return NULL;
+
+  u32 i = bucket[dso_hash(name) % nbucket];
+  for (u32 n = 0; i && i < dso->sym_cnt && n < dso->sym_cnt;
+       ++n, i = chain[i]) {
+    const Elf32_Sym *sym = &dso->symtab[i];
+
+    if (sym->st_shndx == SHN_UNDEF ||
+        ELF32_ST_BIND(sym->st_info) == STB_LOCAL ||
+        sym->st_name >= dso->strsz)
+      continue;
+    if (!strcmp(dso->strtab + sym->st_name, name))
+      return sym;
+  }
+
+  return NULL;
+}
+
+static int dynlink_resolve(const struct dso *dso, u32 index,
+                           struct dso *const *scope, size_t scope_cnt,
+                           u32 *addr) {
+  if (index >= dso->sym_cnt)
+    return -EINVAL;
+
+  const Elf32_Sym *sym = &dso->symtab[index];
+  if (sym->st_name >= dso->strsz)
+    return -EINVAL;
+
+  if (ELF32_ST_BIND(sym->st_info) == STB_LOCAL) {
+    *addr = dso_sym_addr(dso, sym);
+    return 0;
+  }
+
+  const char *name = dso->strtab + sym->st_name;
+  for (size_t i = 0; i < scope_cnt; ++i) {
+    const Elf32_Sym *def = dso_lookup(scope[i], name);
+
+    if (def) {
+      *addr = dso_sym_addr(scope[i], def);
+      return 0;
+    }
+  }
+
+  if (ELF32_ST_BIND(sym->st_info) == STB_WEAK) {
+    *addr = 0;
+    return 0;
+  }
+
+  return -ENOENT;
+}
+
+/*
+ * Apply the relocations of a dso: the relative ones when scope is NULL,
+ * which is done once for a library, the others against scope.
+ */
+static int dynlink_relocate(const struct dso *dso, const Elf32_Rel *rels,
+                            u32 cnt, struct dso *const *scope,
+                            size_t scope_cnt) {
+  for (u32 i = 0; i < cnt; ++i) {
+    u32 type = ELF32_R_TYPE(rels[i].r_info);
+    u32 where = dso->base + rels[i].r_offset;
+    u32 *p = (u32 *)where;
+    u32 addr;
+
+    if (type == R_386_NONE)
+      continue;
+    if (!scope != (type == R_386_RELATIVE))
+      continue;
+    if (!dso_contains(dso, where, sizeof(*p)))
+      return -EINVAL;
+
+    if (type == R_386_RELATIVE) {
+      *p += dso->base;
+      continue;
+    }
+
+    int rc = dynlink_resolve(dso, ELF32_R_SYM(rels[i].r_info), scope,
+                             scope_cnt, &addr);
+    if (rc)
+      return rc;
+
+    switch (type) {
+    case R_386_32:
+      *p += addr;
+      break;
+    case R_386_PC32:
+      *p += addr - where;
+      break;
+    case R_386_GLOB_DAT:
+    case R_386_JMP_SLOT:
+      *p = addr;
+      break;
+    default:
+      return -EINVAL;
+    }
+  }
+
+  return 0;
+}
+
+static int dynlink_relocate_all(const struct dso *dso,
+                                struct dso *const *scope, size_t scope_cnt) {
+  const Elf32_Rel *rel_end = dso->rel + dso->rel_cnt;
+  const Elf32_Rel *jmprel_end = dso->jmprel + dso->jmprel_cnt;
+
+  /* ld may count the plt relocations in both tables: do them once */
+  if (dso->rel_cnt && dso->jmprel_cnt && dso->jmprel >= dso->rel &&
+      dso->jmprel <= rel_end) {
+    u32 cnt = (jmprel_end > rel_end ? jmprel_end : rel_end) - dso->rel;
+
+    return dynlink_relocate(dso, dso->rel, cnt, scope, scope_cnt);
+  }
+
+  int rc = dynlink_relocate(dso, dso->rel, dso->rel_cnt, scope, scope_cnt);
+  if (rc)
+    return rc;
+
+  return dynlink_relocate(dso, dso->jmprel, dso->jmprel_cnt, scope,
+                          scope_cnt);
+}
+
+static int dynlink_lib_check_phdr(const Elf32_Phdr *phdr, size_t size) {
+  if (phdr->p_filesz > phdr->p_memsz || phdr->p_offset > size ||
+      phdr->p_filesz > size - phdr->p_offset)
+    return -EINVAL;
+
+  if (phdr->p_vaddr > DYNLINK_LIB_SIZE_MAX ||
+      phdr->p_memsz > DYNLINK_LIB_SIZE_MAX - phdr->p_vaddr)
+    return -EINVAL;
+
+  return 0;
+}
+
+/*
+ * Load a library from DYNLINK_LIB_DIR, relocated where it landed. Its
+ * writable segment is then kept aside as every rom starts with it.
+ */
+static int dynlink_lib_load(struct shlib *lib, const char *name) {
+  char path[sizeof(DYNLINK_LIB_DIR) + DYNLINK_NAME_MAX];
+  size_t len = strlen(name);
+  struct inode inode;
+  Elf32_Ehdr ehdr;
+  Elf32_Phdr phdrs[LOADER_PHDR_MAX];
+
+  if (!len || len >= DYNLINK_NAME_MAX)
+    return -EINVAL;
+  memcpy(path, DYNLINK_LIB_DIR, sizeof(DYNLINK_LIB_DIR) - 1);
+  memcpy(path + sizeof(DYNLINK_LIB_DIR) - 1, name, len + 1);
+
+  int rc = vfs_lookup(path, &inode);
+  if (rc)
+    return rc;
+
+  if (inode.size < sizeof(ehdr) || elf_copy(&inode, &ehdr, sizeof(ehdr), 0))
+    return -EINVAL;
+  rc = elf_check_ehdr(&ehdr, inode.size, ET_DYN);
+  if (rc)
+    return rc;
+  rc = elf_copy(&inode, phdrs, ehdr.e_phnum * sizeof(*phdrs), ehdr.e_phoff);
+  if (rc)
+    return rc;
+
+  const Elf32_Phdr *data = NULL;
+  u32 dynamic = 0;
+  u32 size = 0;
+  for (size_t i = 0; i < ehdr.e_phnum; ++i) {
+    const Elf32_Phdr *phdr = &phdrs[i];
+
+    if (phdr->p_type == PT_DYNAMIC)
+      dynamic = phdr->p_vaddr;
+    if (phdr->p_type != PT_LOAD)
+      continue;
+    if (dynlink_lib_check_phdr(phdr, inode.size))
+      return -EINVAL;
+
+    if (phdr->p_flags & PF_W) {
+      if (data)
+        return -EINVAL;
+      data = phdr;
+    }
+    if (phdr->p_vaddr + phdr->p_memsz > size)
+      size = phdr->p_vaddr + phdr->p_memsz;
+  }
+  if (!dynamic || !data)
+    return -EINVAL;
+
+  void *mem = memory_reserve(size + PAGE_SIZE);
+  if (!mem && pcache_shrink(-1))
+    mem = memory_reserve(size + PAGE_SIZE);
+  if (!mem)
+    return -ENOMEM;
+
+  u32 base = align_up((u32)mem, PAGE_SIZE);
+  for (size_t i = 0; i < ehdr.e_phnum; ++i) {
+    const Elf32_Phdr *phdr = &phdrs[i];
+    char *dst = (char *)base + phdr->p_vaddr;
+
+    if (phdr->p_type != PT_LOAD)
+      continue;
+
+    rc = elf_copy(&inode, dst, phdr->p_filesz, phdr->p_offset);
+    if (rc)
+      goto err;
+    elf_zero(dst + phdr->p_filesz, phdr->p_memsz - phdr->p_filesz);
+  }
+
+  lib->dso = (struct dso){.base = base, .start = base, .end = base + size};
+  rc = dso_parse(&lib->dso, base + dynamic);
+  if (!rc && lib->dso.needed)
+    rc = -EINVAL;
+  if (!rc)
+    rc = dynlink_relocate_all(&lib->dso, NULL, 0);
+  if (rc)
+    goto err;
+
+  /* what is left to relocate is per rom: it has to be in their state */
+  lib->data = base + data->p_vaddr;
+  lib->data_end = lib->data + data->p_filesz;
+  lib->end = lib->data + data->p_memsz;
+  lib->dso.start = lib->data;
+  lib->dso.end = lib->end;
+
+  lib->pristine = memory_reserve(data->p_filesz);
+  if (!lib->pristine) {
+    rc = -ENOMEM;
+    goto err;
+  }
+  memcpy(lib->pristine, (void *)lib->data, data->p_filesz);
+  memcpy(lib->name, name, len + 1);
+
+  return 0;
+
+err:
+  memory_release(mem);
+  return rc;
+}
+
+static int dynlink_lib_get(const char *name, struct shlib **lib) {
+  struct shlib *slot = NULL;
+
+  for (size_t i = 0; i < array_size(libs); ++i) {
+    if (!strcmp(libs[i].name, name)) {
+      *lib = &libs[i];
+      return 0;
+    }
+    if (!slot && !libs[i].name[0])
+      slot = &libs[i];
+  }
+
+  if (!slot)
+    return -ENOMEM;
+
+  int rc = dynlink_lib_load(slot, name);
+  if (rc)
+    return rc;
+
+  *lib = slot;
+  return 0;
+}
+
+/*
+ * Link a rom just loaded with the library it needs, loading it on first
+ * use, and tell the rom state of the library in img.
+ */
+int dynlink_rom(struct elf_image *img, u32 dynamic) {
+  struct dso rom = {.start = img->start, .end = img->end};
+  struct dso *scope[2] = {&rom};
+  size_t scope_cnt = 1;
+
+  int rc = dso_parse(&rom, dynamic);
+  if (rc)
+    return rc;
+
+  if (rom.needed) {
+    struct shlib *lib;
+
+    rc = dynlink_lib_get(rom.strtab + rom.needed, &lib);
+    if (rc)
+      return rc;
+
+    /* undo the linking of the previous rom */
+    memcpy((void *)lib->data, lib->pristine, lib->data_end - lib->data);
+    elf_zero((void *)lib->data_end, lib->end - lib->data_end);
+    scope[scope_cnt++] = &lib->dso;
+
+    rc = dynlink_relocate_all(&lib->dso, scope, scope_cnt);
+    if (rc)
+      return rc;
+
+    img->lib_start = lib->data;
+    img->lib_data_end = lib->data_end;
+    img->lib_end = lib->end;
+  }
+
+  return dynlink_relocate_all(&rom, scope, scope_cnt);
+}
@@ -0,0 +1,39 @@
+#ifndef DYNLINK_H
+#define DYNLINK_H
+
+#include "loader.h"
+
+#define DYNLINK_LIB_DIR "/lib/"
+#define DYNLINK_LIB_MAX 2 /* shared libraries kept loaded */
+#define DYNLINK_NAME_MAX 32
+#define DYNLINK_LIB_SIZE_MAX (1 << 20)
+
+/* an ELF object with a dynamic section, once loaded */
+struct dso {
+  u32 base; /* 0 for roms, loaded where they are linked */
+  u32 start; /* relocations are only applied from start to end */
+  u32 end;
+  const Elf32_Sym *symtab;
+  u32 sym_cnt;
+  const char *strtab;
+  u32 strsz;
+  const u32 *hash;
+  const Elf32_Rel *rel;
+  u32 rel_cnt;
+  const Elf32_Rel *jmprel;
+  u32 jmprel_cnt;
+  u32 needed; /* strtab offset of the library needed, 0 for none */
+};
+
+struct shlib {
+  char name[DYNLINK_NAME_MAX]; /* empty when the slot is free */
+  struct dso dso;
+  u32 data; /* writable segment: the state each rom has of the library */
+  u32 data_end;
+  u32 end;
+  void *pristine; /* data to data_end, before any rom is linked */
+};
+
+int dynlink_rom(struct elf_image *img, u32 dynamic);
+
+#endif /* DYNLINK_H */
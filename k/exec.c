@@ -0,0 +1,95 @@
+#include "exec.h"
+
+#include <k/compiler.h>
+
+#include "memory.h"
+#include "pcache.h"
+
+/*
+ * Roms replace each other at LOADER_BASE. Right after a rom is loaded, its
+ * memory is copied aside: launching it again is then a copy of that
+ * pristine image and zeroing its bss, with no file access at all. The
+ * least recently launched rom is dropped when the cache is full or memory
+ * runs out.
+ */
+
+static struct exec_cache cache[EXEC_CACHE_MAX];
+static u32 exec_clock;
+
+static struct exec_cache *exec_cache_find(struct inode *inode) {
+  for (size_t i = 0; i < array_size(cache); ++i) {
+    if (cache[i].fs == inode->fs && cache[i].ino == inode->ino)
+      return &cache[i];
+  }
+
+  return NULL;
+}
+
+static void exec_cache_drop(struct exec_cache *e) {
+  memory_release(e->pristine);
+  e->fs = NULL;
+}
+
+static struct exec_cache *exec_cache_lru(void) {
+  struct exec_cache *lru = &cache[0];
+
+  for (size_t i = 0; i < array_size(cache); ++i) {
+    if (!cache[i].fs)
+      return &cache[i];
+    if (cache[i].last_use < lru->last_use)
+      lru = &cache[i];
+  }
+
+  return lru;
+}
+
+/* keep a copy of the rom just loaded, if memory allows */
+static void exec_cache_add(struct inode *inode, const struct elf_image *img) {
+  size_t size = elf_image_size(img, 1);
+  struct exec_cache *e = exec_cache_lru();
+
+  if (e->fs)
+    exec_cache_drop(e);
+
+  void *pristine = memory_reserve(size);
+  if (!pristine && pcache_shrink(-1))
+    pristine = memory_reserve(size);
+  for (size_t i = 0; !pristine && i < array_size(cache); ++i) {
+    if (cache[i].fs) {
+      exec_cache_drop(&cache[i]);
+      pristine = memory_reserve(size);
+    }
+  }
+  if (!pristine)
+    return;
+
+  e = exec_cache_lru();
+  elf_image_save(img, pristine, 1);
+  e->fs = inode->fs;
+  e->ino = inode->ino;
+  e->last_use = ++exec_clock;
+  e->img = *img;
+  e->pristine = pristine;
+}
+
+/*
+ * Load a rom in place of the running one, from its pristine copy if there
+ * is one. An invalid rom is found out before anything is overwritten, a
+ * read error is not.
+ */
+int exec_load(struct inode *inode, struct elf_image *img) {
+  struct exec_cache *e = exec_cache_find(inode);
+
+  if (!e) {
+    int rc = elf_load(inode, img);
+    if (!rc)
+      exec_cache_add(inode, img);
+    return rc;
+  }
+
+  *img = e->img;
+  e->last_use = ++exec_clock;
+  elf_image_restore(img, e->pristine, 1);
+
+  return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef EXEC_H
+#define EXEC_H
+
+#include "loader.h"
+
+#define EXEC_CACHE_MAX 4 /* roms kept pristine for a relaunch */
+
+struct exec_cache {
+  struct fs *fs; /* NULL when unused */
+  u32 ino;
+  u32 last_use;
+  struct elf_image img;
+  void *pristine; /* file data of img as loaded, see elf_image_save() */
+};
+
+int exec_load(struct inode *inode, struct elf_image *img);
+
+#endif /* EXEC_H */
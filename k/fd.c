@@ -0,0 +1,108 @@
+#include "fd.h"
+
+#include "pcache.h"
+
+static struct fd_table fd_default;
+struct fd_table *fd_current = &fd_default;
+
+int fd_open(struct fd_table *t, const struct inode *inode) {
+  if (t->used == ~0u)
+    return -ENOMEM;
+
+  int fd = __builtin_ctz(~t->used);
+  struct file *file = &t->files[fd];
+
+  t->used |= 1u << fd;
+  file->inode = *inode;
+  file->pos = 0;
+  file->ra_start = 0;
+  file->ra_size = 0;
+  file->last_end = 0;
+
+  return fd;
+}
+
+struct file *fd_get(struct fd_table *t, int fd) {
+  if (fd < 0 || fd >= FD_MAX || !(t->used & (1u << fd)))
+    return NULL;
+
+  return &t->files[fd];
+}
+
+int fd_close(struct fd_table *t, int fd) {
+  if (!fd_get(t, fd))
+    return -EBADF;
+
+  t->used &= ~(1u << fd);
+
+  return 0;
+}
+
+void fd_close_all(struct fd_table *t) { t->used = 0; }
+
+/*
+ * Sequential readers get a readahead window that doubles on each hit, up to
+ * FD_RA_MAX pages. The window is filled with a single transfer, so loaders
+ * walking a file with small reads still issue large I/O.
+ */
+static void file_readahead(struct file *file, size_t pos, size_t count) {
+  /* small forward skips, e.g. bmp row padding, still count as sequential */
+  if (pos < file->last_end || pos - file->last_end >= PAGE_SIZE) {
+    file->ra_size = 0;
+    return;
+  }
+
+  u32 last = (pos + count - 1) / PAGE_SIZE;
+  if (file->ra_size && last < file->ra_start + file->ra_size)
+    return;
+
+  if (!file->ra_size)
+    file->ra_size = FD_RA_MIN;
+  else if (file->ra_size < FD_RA_MAX)
+    file->ra_size *= 2;
+
+  file->ra_start = last;
+  pcache_readahead(&file->inode, file->ra_start, file->ra_size);
+}
+
+ssize_t file_read(struct file *file, void *buf, size_t count) {
+  size_t pos = file->pos;
+
+  if (!count || pos >= file->inode.size)
+    return 0;
+
+  file_readahead(file, pos, count);
+
+  ssize_t rc = vfs_read(&file->inode, buf, count, pos);
+  if (rc > 0) {
+    file->pos += rc;
+    file->last_end = file->pos;
+  }
+
+  return rc;
+}
+
+off_t file_seek(struct file *file, off_t offset, int whence) {
+  off_t pos;
+
+  switch (whence) {
+  case SEEK_SET:
+    pos = offset;
+    break;
+  case SEEK_CUR:
+    pos = file->pos + offset;
+    break;
+  case SEEK_END:
+    pos = file->inode.size + offset;
+    break;
+  default:
+    return -EINVAL;
+  }
+
+  if (pos < 0)
+    return -EINVAL;
+
+  file->pos = pos;
+
+  return pos;
+}
@@ -0,0 +1,34 @@
+#ifndef FD_H
+#define FD_H
+
+#include "vfs.h"
+
+#define FD_MAX 32 /* must fit the bitmap */
+
+#define FD_RA_MIN 4 /* readahead window, in pages */
+#define FD_RA_MAX 32
+
+struct file {
+  struct inode inode; /* resolved once at open() */
+  off_t pos;
+  u32 ra_start; /* first page of the readahead window */
+  u32 ra_size;  /* 0 until reads look sequential */
+  size_t last_end;
+};
+
+struct fd_table {
+  u32 used; /* bit n set when fd n is open */
+  struct file files[FD_MAX];
+};
+
+/* table of the running rom */
+extern struct fd_table *fd_current;
+
+int fd_open(struct fd_table *t, const struct inode *inode);
+struct file *fd_get(struct fd_table *t, int fd);
+int fd_close(struct fd_table *t, int fd);
+void fd_close_all(struct fd_table *t);
+ssize_t file_read(struct file *file, void *buf, size_t count);
+off_t file_seek(struct file *file, off_t offset, int whence);
+
+#endif /* FD_H */
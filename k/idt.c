@@ -0,0 +1,73 @@
+#include "idt.h"
+
+#include <k/compiler.h>
+#include <k/types.h>
+
+/*
+ * Descriptor tables. Everything runs in ring 0 on flat segments: the gdt
+ * only replaces the one grub left, which may be anywhere, and the idt only
+ * has the system call gate that libk traps through with int $0x80.
+ */
+
+#define IDT_TRAP_GATE 0x8f /* present, ring 0, 32-bit trap gate */
+
+struct idt_gate {
+  u16 offset_lo;
+  u16 selector;
+  u8 zero;
+  u8 flags;
+  u16 offset_hi;
+} __packed;
+
+struct dt_ptr {
+  u16 limit;
+  u32 base;
+} __packed;
+
+static const u64 gdt[] = {
+    0,
+    0x00cf9a000000ffffull, /* KERNEL_CS: 4 GiB code */
+    0x00cf92000000ffffull, /* KERNEL_DS: 4 GiB data */
+};
+
+static struct idt_gate idt[256];
+
+/* see isr.S */
+void syscall_entry(void);
+
+static void idt_set_gate(u8 vector, void (*handler)(void), u8 flags) {
+  struct idt_gate *gate = &idt[vector];
+
+  gate->offset_lo = (u32)handler & 0xffff;
+  gate->offset_hi = (u32)handler >> 16;
+  gate->selector = KERNEL_CS;
+  gate->zero = 0;
+  gate->flags = flags;
+}
+
+static void gdt_load(void) {
+  struct dt_ptr ptr = {sizeof(gdt) - 1, (u32)gdt};
+
+  asm volatile("lgdt %0\n\t"
+               "ljmp %1, $1f\n"
+               "1:\n\t"
+               "mov %2, %%ax\n\t"
+               "mov %%ax, %%ds\n\t"
+               "mov %%ax, %%es\n\t"
+               "mov %%ax, %%fs\n\t"
+               "mov %%ax, %%gs\n\t"
+               "mov %%ax, %%ss"
+               :
+               : "m"(ptr), "i"(KERNEL_CS), "i"(KERNEL_DS)
+               : "eax", "memory");
+}
+
+void idt_init(void) {
+  gdt_load();
+
+  /* a trap gate: the handler may switch roms, see rom_switch() */
+  idt_set_gate(IDT_SYSCALL, syscall_entry, IDT_TRAP_GATE);
+
+  struct dt_ptr ptr = {sizeof(idt) - 1, (u32)idt};
+  asm volatile("lidt %0" : : "m"(ptr));
+}
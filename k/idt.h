@@ -0,0 +1,11 @@
+#ifndef IDT_H
+#define IDT_H
+
+#define KERNEL_CS 0x08
+#define KERNEL_DS 0x10
+
+#define IDT_SYSCALL 0x80
+
+void idt_init(void);
+
+#endif /* IDT_H */
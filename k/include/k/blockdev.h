@@ -3,12 +3,17 @@
 
 #include <assert.h>
 #include <k/types.h>
+#include <string.h>
 
 struct blockdev;
 
 struct blk_ops {
   void *(*read)(struct blockdev *, size_t);
   void (*free_blk)(struct blockdev *, void *);
+  /* optional, copy contiguous blocks in a single transfer */
+  size_t (*read_blks)(struct blockdev *, size_t, size_t, void *);
+  /* optional, only for memory backed devices */
+  void *(*map)(struct blockdev *, size_t, size_t);
 };
 
 struct blockdev {
@@ -34,4 +39,42 @@ static inline void block_free(struct blockdev *bd, void *ptr) {
   bd->ops->free_blk(bd, ptr);
 }
 
+/*
+ * Copy cnt blocks starting at lba into buf.
+ * Returns the number of blocks actually read.
+ */
+static inline size_t block_read_blks(struct blockdev *bd, size_t lba,
+                                     size_t cnt, void *buf) {
+  assert(bd);
+  assert(bd->ops);
+
+  if (bd->ops->read_blks)
+    return bd->ops->read_blks(bd, lba, cnt, buf);
+
+  for (size_t i = 0; i < cnt; ++i) {
+    void *blk = block_read(bd, lba + i);
+    if (!blk)
+      return i;
+
+    memcpy((char *)buf + i * bd->blk_size, blk, bd->blk_size);
+    block_free(bd, blk);
+  }
+
+  return cnt;
+}
+
+/*
+ * Direct pointer to cnt contiguous blocks starting at lba, or NULL if the
+ * device is not memory backed. The blocks must not be freed.
+ */
+static inline void *block_map(struct blockdev *bd, size_t lba, size_t cnt) {
+  assert(bd);
+  assert(bd->ops);
+
+  if (!bd->ops->map)
+    return NULL;
+
+  return bd->ops->map(bd, lba, cnt);
+}
+
 #endif /* BLOCKDEV_H_ */
@@ -0,0 +1,27 @@
+#ifndef K_BUNDLE_H
+#define K_BUNDLE_H
+
+#include <k/types.h>
+
+/*
+ * Asset bundle, written by mkbundle and linked into the .rodata of a rom,
+ * see roms.lds. A header, the entries sorted by name, then the names and
+ * the file contents. Offsets are from the start of the bundle.
+ */
+
+#define BUNDLE_MAGIC 0x4c444e42 /* "BNDL" */
+
+#define BUNDLE_ALIGN 4
+
+struct bundle_header {
+  u32 magic;
+  u32 cnt;
+};
+
+struct bundle_entry {
+  u32 name;
+  u32 offset;
+  u32 size;
+};
+
+#endif
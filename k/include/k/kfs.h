@@ -11,11 +11,15 @@
 
 #define KFS_BLK_DATA_SZ (KFS_BLK_SZ - 3 * 4)
 
-#define KFS_DIRECT_BLK 10
-
-#define KFS_INDIRECT_BLK 16
+/*
+ * Version 2 replaced the direct and indirect block lists of inodes with
+ * extents of contiguous blocks. Version 3 added the filename index,
+ * version 4 compressed files, version 5 packed tails and version 6 the
+ * modification time of files.
+ */
+#define KFS_VERSION 6
 
-#define KFS_INDIRECT_BLK_CNT 16
+#define KFS_EXTENT_CNT 16
 
 #define KFS_FNAME_SZ 32
 
@@ -23,6 +27,9 @@
 
 #define __packed __attribute__((__packed__))
 
+/* set in usage when data holds compressed bytes, see <k/lz.h> */
+#define KFS_BLK_LZ 0x80000000u
+
 struct kfs_block {
   u32 idx;
   u32 usage;
@@ -30,13 +37,29 @@ struct kfs_block {
   u8 data[KFS_BLK_DATA_SZ];
 } __packed;
 
-struct kfs_iblock {
+/* most file bytes a compressed block may expand to */
+#define KFS_LZ_RAW_MAX 32768
+
+#define KFS_LZMAP_CNT ((KFS_BLK_SZ - 3 * 4) / 4)
+
+/*
+ * Compressed blocks each hold as much of the file as fits once compressed,
+ * so an lzmap block of a compressed file gives the file offset where the
+ * data of each of its blocks starts. Files compressed in a single block
+ * need no lzmap.
+ */
+struct kfs_lzmap {
   u32 idx;
   u32 blk_cnt;
-  u32 blks[KFS_INDIRECT_BLK_CNT];
+  u32 raw_off[KFS_LZMAP_CNT];
   u32 cksum;
 } __packed;
 
+struct kfs_extent {
+  u32 start;
+  u32 blk_cnt;
+} __packed;
+
 struct kfs_inode {
   u32 inumber;
   char filename[KFS_FNAME_SZ];
@@ -44,48 +67,279 @@ struct kfs_inode {
   u32 idx;
   u32 blk_cnt;
   u32 next_inode;
-  u32 d_blk_cnt;
-  u32 i_blk_cnt;
-  u32 d_blks[KFS_DIRECT_BLK];
-  u32 i_blks[KFS_INDIRECT_BLK];
+  u32 extent_cnt;
+  struct kfs_extent extents[KFS_EXTENT_CNT];
+  u32 flags;
+  u32 lz_map; /* lzmap block of a compressed file, if any */
+  /*
+   * The end of a file may be packed with others in a data block: it
+   * follows the blk_cnt blocks of its extents, or for a compressed file
+   * with no block holds its whole compressed data.
+   */
+  u32 tail_blk;
+  u32 tail_off;
+  u32 tail_len;
+  s32 mtime; /* of the file the image was built from */
+  u32 cksum;
+} __packed;
+
+struct kfs_index_entry {
+  u32 hash;
+  u32 inode_idx; /* 0 for a free slot */
+} __packed;
+
+#define KFS_INDEX_SLOTS                                                        \
+  ((KFS_BLK_SZ - 3 * 4) / sizeof(struct kfs_index_entry))
+
+/*
+ * The filename index is a hash table spread over index_blk_cnt blocks: a
+ * name hashing to h lives in block h % index_blk_cnt, in the first free
+ * slot at or after (h / index_blk_cnt) % KFS_INDEX_SLOTS.
+ */
+struct kfs_index {
+  u32 idx;
+  u32 entry_cnt;
+  struct kfs_index_entry entries[KFS_INDEX_SLOTS];
   u32 cksum;
 } __packed;
 
+#define KFS_INODE_LZ (1 << 0)
+
 struct kfs_blk {
   union {
     struct kfs_block blk;
-    struct kfs_iblock iblk;
     struct kfs_inode ino;
+    struct kfs_index index;
+    struct kfs_lzmap lzmap;
     u8 whole_blk[KFS_BLK_SZ];
   };
 };
 
 struct kfs_superblock {
   u32 magic;
+  u32 version;
   char name[KFS_NAME_SZ];
   s32 ctime;
   u32 blk_cnt;
   u32 inode_cnt;
   u32 inode_idx;
+  u32 index_idx; /* 0 when the image has no filename index */
+  u32 index_blk_cnt;
   u32 cksum;
 } __packed;
 
+/**
+ * @brief FNV-1a hash of a filename, as used by the filename index.
+ */
+static inline u32 kfs_name_hash(const char *name) {
+  u32 hash = 2166136261u;
+
+  for (size_t i = 0; i < KFS_FNAME_SZ && name[i]; ++i) {
+    hash ^= (u8)name[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * @brief Block index of the n-th data block of a file, 0 past its last
+ *        extent: block 0 is the superblock, never file data.
+ */
+static inline u32 kfs_bmap(const struct kfs_inode *ino, u32 n) {
+  u32 cnt = ino->extent_cnt;
+
+  if (cnt > KFS_EXTENT_CNT)
+    cnt = KFS_EXTENT_CNT;
+
+  for (u32 i = 0; i < cnt; ++i) {
+    if (n < ino->extents[i].blk_cnt)
+      return ino->extents[i].start + n;
+    n -= ino->extents[i].blk_cnt;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Compressed block n holding file offset pos, and the file range
+ *        [start, end) it decompresses to. map is NULL for a file of a
+ *        single compressed block.
+ */
+static inline int kfs_lz_find(const struct kfs_lzmap *map,
+                              const struct kfs_inode *ino, size_t pos, u32 *n,
+                              size_t *start, size_t *end) {
+  u32 lo = 0;
+  u32 hi = map ? map->blk_cnt : 1;
+
+  if (!hi || hi > KFS_LZMAP_CNT)
+    return -1;
+
+  while (hi - lo > 1) {
+    u32 mid = lo + (hi - lo) / 2;
+
+    if (map->raw_off[mid] <= pos)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  *n = lo;
+  *start = map ? map->raw_off[lo] : 0;
+  *end = map && lo + 1 < map->blk_cnt ? map->raw_off[lo + 1] : ino->file_sz;
+
+  if (*start > pos || *end <= pos || *end - *start > KFS_LZ_RAW_MAX)
+    return -1;
+  return 0;
+}
+
 #define ADLER32_MOD 65521
 
+/*
+ * Largest n such that 255n(n+1)/2 + (n+1)(ADLER32_MOD-1) fits in 32 bits:
+ * that many bytes can be summed before a and b have to be reduced.
+ */
+#define ADLER32_NMAX 5552
+
+/*
+ * The vector variants are for host tools only: the intrinsics headers need a
+ * hosted libc, and the kernel is built for a CPU without SSE anyway.
+ */
+#if __STDC_HOSTED__ && defined(__SSE2__)
+#define KFS_ADLER32_SSE2
+#if defined(__SSSE3__)
+#define KFS_ADLER32_SSSE3
+#include <tmmintrin.h>
+#else
+#include <emmintrin.h>
+#endif
+#endif
+
+#if defined(KFS_ADLER32_SSE2)
+static inline unsigned int kfs_adler32_hsum(__m128i v) {
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(v);
+}
+
 /**
- * @brief Adler32 checksum.
+ * @brief Sum len bytes (a multiple of 16, at most ADLER32_NMAX) into a and b,
+ *        without reducing them.
  */
-static inline unsigned int kfs_checksum(const void *data, size_t size) {
-  unsigned int a = 1;
-  unsigned int b = 0;
-  size_t i = 0;
+static inline void kfs_adler32_blocks(unsigned int *a, unsigned int *b,
+                                      const u8 *buf, size_t len) {
+  const __m128i zero = _mm_setzero_si128();
+#if defined(KFS_ADLER32_SSSE3)
+  const __m128i taps = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6,
+                                     5, 4, 3, 2, 1);
+  const __m128i ones = _mm_set1_epi16(1);
+#else
+  const __m128i taps_lo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+  const __m128i taps_hi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+#endif
+  __m128i v_s1 = zero;
+  __m128i v_s2 = zero;
+  __m128i v_ps = zero;
+
+  *b += *a * len;
+  for (; len; len -= 16, buf += 16) {
+    const __m128i x = _mm_loadu_si128((const __m128i *)buf);
+
+    /* every byte already summed is added to b once more per 16 bytes */
+    v_ps = _mm_add_epi32(v_ps, v_s1);
+    v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(x, zero));
+#if defined(KFS_ADLER32_SSSE3)
+    v_s2 = _mm_add_epi32(
+        v_s2, _mm_madd_epi16(_mm_maddubs_epi16(x, taps), ones));
+#else
+    v_s2 = _mm_add_epi32(
+        v_s2, _mm_madd_epi16(_mm_unpacklo_epi8(x, zero), taps_lo));
+    v_s2 = _mm_add_epi32(
+        v_s2, _mm_madd_epi16(_mm_unpackhi_epi8(x, zero), taps_hi));
+#endif
+  }
+
+  *a += kfs_adler32_hsum(v_s1);
+  *b += kfs_adler32_hsum(_mm_add_epi32(_mm_slli_epi32(v_ps, 4), v_s2));
+}
+#else
+/**
+ * @brief Sum len bytes (a multiple of 16, at most ADLER32_NMAX) into a and b,
+ *        without reducing them.
+ */
+static inline void kfs_adler32_blocks(unsigned int *a, unsigned int *b,
+                                      const u8 *buf, size_t len) {
+  unsigned int s1 = *a;
+  unsigned int s2 = *b;
+
+#define ADLER32_DO1(i)                                                         \
+  s1 += buf[i];                                                                \
+  s2 += s1
+#define ADLER32_DO4(i)                                                         \
+  ADLER32_DO1(i);                                                              \
+  ADLER32_DO1(i + 1);                                                          \
+  ADLER32_DO1(i + 2);                                                          \
+  ADLER32_DO1(i + 3)
+
+  for (; len; len -= 16, buf += 16) {
+    ADLER32_DO4(0);
+    ADLER32_DO4(4);
+    ADLER32_DO4(8);
+    ADLER32_DO4(12);
+  }
+
+#undef ADLER32_DO4
+#undef ADLER32_DO1
+
+  *a = s1;
+  *b = s2;
+}
+#endif
+
+/**
+ * @brief Update an Adler32 checksum with more data.
+ */
+static inline unsigned int kfs_adler32(unsigned int adler, const void *data,
+                                       size_t size) {
+  unsigned int a = adler & 0xffff;
+  unsigned int b = adler >> 16;
   const u8 *buf = data;
 
-  while (i < size) {
-    a += buf[i++];
+  while (size >= 16) {
+    size_t len = (size < ADLER32_NMAX ? size : ADLER32_NMAX) & ~(size_t)15;
+
+    kfs_adler32_blocks(&a, &b, buf, len);
+    a %= ADLER32_MOD;
+    b %= ADLER32_MOD;
+    buf += len;
+    size -= len;
+  }
+
+  while (size--) {
+    a += *buf++;
     b += a;
   }
-  return ((b % ADLER32_MOD) << 16) | (a % ADLER32_MOD);
+  if (a >= ADLER32_MOD)
+    a -= ADLER32_MOD;
+  return ((b % ADLER32_MOD) << 16) | a;
+}
+
+/**
+ * @brief Adler32 checksum.
+ */
+static inline unsigned int kfs_checksum(const void *data, size_t size) {
+  return kfs_adler32(1, data, size);
+}
+
+/**
+ * @brief Checksum of a data block, computed with a null cksum field.
+ */
+static inline unsigned int kfs_block_checksum(const struct kfs_block *blk) {
+  static const u8 zero[sizeof(blk->cksum)];
+  unsigned int adler;
+
+  adler = kfs_checksum(blk, offsetof(struct kfs_block, cksum));
+  adler = kfs_adler32(adler, zero, sizeof(zero));
+  return kfs_adler32(adler, blk->data, sizeof(blk->data));
 }
 
 #endif
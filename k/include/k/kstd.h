@@ -138,7 +138,11 @@ enum e_mouse_codes { BUTTON_LEFT = 1, BUTTON_RIGHT = 2 };
 #define SYSCALL_SETPALETTE 12
 
 #define SYSCALL_GETMOUSE 13
-#define NR_SYSCALL (SYSCALL_GETMOUSE + 1)
+#define SYSCALL_MMAP 14
+#define SYSCALL_MUNMAP 15
+#define SYSCALL_EXEC 16
+#define SYSCALL_SWITCH 17
+#define NR_SYSCALL (SYSCALL_SWITCH + 1)
 
 #define ENOMEM 1 /* Not enough space */
 #define ENOENT 2 /* No such file or directory */
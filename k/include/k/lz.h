@@ -0,0 +1,89 @@
+#ifndef K_LZ_H
+#define K_LZ_H
+
+#include <k/types.h>
+#include <string.h>
+
+/*
+ * LZ4-style byte oriented compression. A compressed buffer is a list of
+ * sequences, each made of:
+ * - a token: literal count in the high nibble, match length minus
+ *   LZ_MIN_MATCH in the low nibble. A nibble of 15 is followed by extra
+ *   length bytes, added up until one is not 255;
+ * - the literals;
+ * - unless the buffer ends right after the literals, a little endian 16 bit
+ *   match offset back into the output.
+ */
+
+#define LZ_MIN_MATCH 4
+
+#define LZ_MAX_OFFSET 65535
+
+static inline int lz_read_len(const u8 **ip, const u8 *iend, size_t *len) {
+  u8 b;
+
+  do {
+    if (*ip >= iend)
+      return -1;
+    b = *(*ip)++;
+    *len += b;
+  } while (b == 255);
+
+  return 0;
+}
+
+/**
+ * @brief Decompress src into dst.
+ * @return the decompressed size, or -1 if src is corrupted or does not fit.
+ */
+static inline int lz_decompress(const void *src, size_t src_sz, void *dst,
+                                size_t dst_sz) {
+  const u8 *ip = src;
+  const u8 *iend = ip + src_sz;
+  u8 *op = dst;
+  u8 *oend = op + dst_sz;
+
+  while (ip < iend) {
+    u8 token = *ip++;
+    size_t len = token >> 4;
+
+    if (len == 15 && lz_read_len(&ip, iend, &len))
+      return -1;
+    if (len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+      return -1;
+
+    memcpy(op, ip, len);
+    op += len;
+    ip += len;
+    if (ip == iend)
+      break;
+
+    if (iend - ip < 2)
+      return -1;
+
+    size_t off = ip[0] | ip[1] << 8;
+    ip += 2;
+    if (!off || off > (size_t)(op - (u8 *)dst))
+      return -1;
+
+    len = (token & 15) + LZ_MIN_MATCH;
+    if ((token & 15) == 15 && lz_read_len(&ip, iend, &len))
+      return -1;
+    if (len > (size_t)(oend - op))
+      return -1;
+
+    const u8 *match = op - off;
+    if (off >= len) {
+      memcpy(op, match, len);
+      op += len;
+    } else {
+      /* overlapping match: a repeated pattern */
+      while (len--)
+        *op++ = *match++;
+    }
+  }
+
+  return op - (u8 *)dst;
+}
+
+#endif
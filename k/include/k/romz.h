@@ -0,0 +1,48 @@
+#ifndef K_ROMZ_H
+#define K_ROMZ_H
+
+#include <k/types.h>
+
+/*
+ * Compressed rom container, written by mkromz. It holds the PT_LOAD
+ * segments of a rom ELF and nothing else: a header, then the file bytes of
+ * each segment as a list of chunks compressed independently, see <k/lz.h>.
+ * A chunk never crosses a page boundary, so that it can be decompressed
+ * straight from the page cache: a chunk header with a zero length, or less
+ * room than a chunk header before the page end, means the segment goes on
+ * at the next page.
+ */
+
+#define ROMZ_MAGIC 0x5a4d4f52 /* "ROMZ" */
+
+#define ROMZ_SEG_MAX 16
+
+#define ROMZ_PAGE_SZ 4096
+
+/* most bytes a chunk may expand to */
+#define ROMZ_CHUNK_RAW_MAX 32768
+
+#define __packed __attribute__((__packed__))
+
+struct romz_segment {
+  u32 vaddr;
+  u32 filesz;
+  u32 memsz;
+  u32 offset; /* first chunk, in the container */
+  u32 size;   /* chunks and padding, in bytes */
+} __packed;
+
+struct romz_header {
+  u32 magic;
+  u32 entry;
+  u32 dynamic; /* PT_DYNAMIC address, 0 for a static rom */
+  u32 seg_cnt;
+  struct romz_segment segs[ROMZ_SEG_MAX];
+} __packed;
+
+struct romz_chunk {
+  u16 raw_len;
+  u16 len;
+} __packed;
+
+#endif
@@ -0,0 +1,295 @@
+#include "iso.h"
+
+#include <k/compiler.h>
+#include <string.h>
+
+#include "memory.h"
+
+#define ISO_PATH_ROOT 1
+
+/*
+ * The little endian path table is loaded once at mount time. Records are
+ * sorted by parent, so the subdirectories of a directory are contiguous and
+ * resolving a directory only scans its own children. Only the last path
+ * component needs a directory extent scan.
+ */
+
+static int iso_load_path_table(struct iso_fs *fs,
+                               const struct iso_prim_voldesc *voldesc) {
+  size_t sz = voldesc->path_table_size.le;
+  size_t blk = voldesc->le_path_table_blk;
+
+  fs->path_table = memory_reserve(sz);
+  if (!fs->path_table)
+    return -ENOMEM;
+  fs->path_table_sz = sz;
+
+  for (size_t off = 0; off < sz; off += ISO_BLOCK_SIZE, ++blk) {
+    void *data = block_read(fs->bd, blk);
+    if (!data)
+      return -EIO;
+
+    size_t len = sz - off < ISO_BLOCK_SIZE ? sz - off : ISO_BLOCK_SIZE;
+    memcpy(fs->path_table + off, data, len);
+    block_free(fs->bd, data);
+  }
+
+  size_t cnt = 0;
+  for (size_t off = 0; off + sizeof(struct iso_path_table_le) <= sz;) {
+    struct iso_path_table_le *rec = (void *)(fs->path_table + off);
+    off += sizeof(*rec) + rec->idf_len + (rec->idf_len & 1);
+    cnt++;
+  }
+
+  fs->paths = memory_reserve((cnt + 1) * sizeof(*fs->paths));
+  if (!fs->paths)
+    return -ENOMEM;
+  fs->path_cnt = cnt;
+  memset(fs->paths, 0, (cnt + 1) * sizeof(*fs->paths));
+
+  size_t off = 0;
+  for (size_t i = 1; i <= cnt; ++i) {
+    struct iso_path_table_le *rec = (void *)(fs->path_table + off);
+    struct iso_path *p = &fs->paths[i];
+
+    p->data_blk = rec->data_blk;
+    p->parent = rec->parent_dir;
+    p->idf_len = rec->idf_len;
+    p->idf = rec->idf;
+
+    if (i != ISO_PATH_ROOT && p->parent <= cnt &&
+        !fs->paths[p->parent].first_child)
+      fs->paths[p->parent].first_child = i;
+
+    off += sizeof(*rec) + rec->idf_len + (rec->idf_len & 1);
+  }
+
+  return 0;
+}
+
+static int iso_fs_lookup(struct fs *fs, const char *path,
+                         struct inode *inode);
+static ssize_t iso_fs_read(struct inode *inode, void *buf, size_t count,
+                           off_t off);
+static void *iso_fs_mmap(struct inode *inode);
+
+static struct fs_ops iso_fs_ops = {
+    .lookup = iso_fs_lookup,
+    .read = iso_fs_read,
+    .mmap = iso_fs_mmap,
+};
+
+int iso_mount(struct iso_fs *fs, struct blockdev *bd) {
+  if (bd->blk_size != ISO_BLOCK_SIZE)
+    return -EINVAL;
+
+  fs->fs.ops = &iso_fs_ops;
+  fs->bd = bd;
+
+  struct iso_prim_voldesc *voldesc = block_read(bd, ISO_PRIM_VOLDESC_BLOCK);
+  if (!voldesc)
+    return -EIO;
+
+  int rc = -EINVAL;
+  if (voldesc->vol_desc_type == 1 &&
+      !strncmp(voldesc->std_identifier, "CD001", 5))
+    rc = iso_load_path_table(fs, voldesc);
+
+  block_free(bd, voldesc);
+
+  return rc;
+}
+
+/* compare an on-disk identifier with a path component, ignoring case, the
+ * ";1" version suffix and the trailing dot of extension-less files */
+static int iso_name_match(const char *idf, size_t idf_len, const char *name,
+                          size_t len) {
+  const char *version = memchr(idf, ';', idf_len);
+  if (version)
+    idf_len = version - idf;
+  if (idf_len && idf[idf_len - 1] == '.')
+    idf_len--;
+
+  return idf_len == len && !strncasecmp(idf, name, len);
+}
+
+static size_t iso_path_find(struct iso_fs *fs, size_t dir, const char *name,
+                            size_t len) {
+  size_t i = fs->paths[dir].first_child;
+
+  if (!i)
+    return 0;
+
+  for (; i <= fs->path_cnt && fs->paths[i].parent == dir; ++i) {
+    if (iso_name_match(fs->paths[i].idf, fs->paths[i].idf_len, name, len))
+      return i;
+  }
+
+  return 0;
+}
+
+static int iso_dir_find(struct iso_fs *fs, size_t dir_blk, const char *name,
+                        size_t len, struct iso_dir *dir) {
+  size_t dir_sz = ISO_BLOCK_SIZE;
+
+  for (size_t blk = 0; blk * ISO_BLOCK_SIZE < dir_sz; ++blk) {
+    char *data = block_read(fs->bd, dir_blk + blk);
+    if (!data)
+      return -EIO;
+
+    for (size_t off = 0; off + sizeof(struct iso_dir) <= ISO_BLOCK_SIZE;) {
+      struct iso_dir *rec = (void *)(data + off);
+
+      /* records never cross a block, a zero size means the block is done */
+      if (!rec->dir_size)
+        break;
+      off += rec->dir_size;
+
+      /* the "." record carries the size of the directory extent */
+      if (rec->idf_len == 1 && rec->idf[0] == 0) {
+        if (!blk)
+          dir_sz = rec->file_size.le;
+        continue;
+      }
+
+      /* only files: directories are reached through the path table */
+      if (rec->type & ISO_FILE_ISDIR)
+        continue;
+
+      if (iso_name_match(rec->idf, rec->idf_len, name, len)) {
+        *dir = *rec;
+        block_free(fs->bd, data);
+        return 0;
+      }
+    }
+
+    block_free(fs->bd, data);
+  }
+
+  return -ENOENT;
+}
+
+int iso_lookup(struct iso_fs *fs, const char *path, struct iso_dir *dir) {
+  size_t cur = ISO_PATH_ROOT;
+
+  for (;;) {
+    while (*path == '/')
+      path++;
+
+    const char *end = memchr(path, '/', strlen(path));
+    if (!end)
+      break;
+
+    cur = iso_path_find(fs, cur, path, end - path);
+    if (!cur)
+      return -ENOENT;
+
+    path = end;
+  }
+
+  if (!*path)
+    return -EINVAL;
+
+  return iso_dir_find(fs, fs->paths[cur].data_blk, path, strlen(path), dir);
+}
+
+/* copy part of a single block */
+static int iso_read_partial(struct iso_fs *fs, size_t blk, size_t blk_off,
+                            void *buf, size_t len) {
+  char *data = block_read(fs->bd, blk);
+  if (!data)
+    return -EIO;
+
+  memcpy(buf, data + blk_off, len);
+  block_free(fs->bd, data);
+
+  return 0;
+}
+
+/*
+ * Files are contiguous on an ISO9660 volume, so a read maps to a single LBA
+ * range: the whole blocks it covers are fetched with one multi block
+ * transfer straight into buf, only the unaligned head and tail go through
+ * block_read().
+ */
+static ssize_t iso_extent_read(struct iso_fs *fs, u32 data_blk, u32 file_sz,
+                               void *buf, size_t count, off_t off) {
+  if (off < 0)
+    return -EINVAL;
+  if ((size_t)off >= file_sz)
+    return 0;
+  if (count > file_sz - off)
+    count = file_sz - off;
+
+  char *dst = buf;
+  size_t blk = data_blk + off / ISO_BLOCK_SIZE;
+  size_t blk_off = off % ISO_BLOCK_SIZE;
+  size_t left = count;
+
+  if (blk_off) {
+    size_t len = ISO_BLOCK_SIZE - blk_off;
+    if (len > left)
+      len = left;
+
+    if (iso_read_partial(fs, blk++, blk_off, dst, len))
+      return -EIO;
+    dst += len;
+    left -= len;
+  }
+
+  size_t cnt = left / ISO_BLOCK_SIZE;
+  if (cnt) {
+    size_t done = block_read_blks(fs->bd, blk, cnt, dst);
+
+    dst += done * ISO_BLOCK_SIZE;
+    if (done != cnt)
+      goto short_read;
+
+    blk += cnt;
+    left -= cnt * ISO_BLOCK_SIZE;
+  }
+
+  if (left && iso_read_partial(fs, blk, 0, dst, left))
+    goto short_read;
+
+  return count;
+
+short_read:
+  if (dst == (char *)buf)
+    return -EIO;
+  return dst - (char *)buf;
+}
+
+ssize_t iso_read(struct iso_fs *fs, const struct iso_dir *dir, void *buf,
+                 size_t count, off_t off) {
+  return iso_extent_read(fs, dir->data_blk.le, dir->file_size.le, buf, count,
+                         off);
+}
+
+static int iso_fs_lookup(struct fs *fs, const char *path,
+                         struct inode *inode) {
+  struct iso_dir dir;
+  int rc = iso_lookup(container_of(fs, struct iso_fs, fs), path, &dir);
+
+  if (rc)
+    return rc;
+
+  inode->fs = fs;
+  inode->ino = dir.data_blk.le;
+  inode->size = dir.file_size.le;
+
+  return 0;
+}
+
+static ssize_t iso_fs_read(struct inode *inode, void *buf, size_t count,
+                           off_t off) {
+  return iso_extent_read(container_of(inode->fs, struct iso_fs, fs),
+                         inode->ino, inode->size, buf, count, off);
+}
+
+static void *iso_fs_mmap(struct inode *inode) {
+  struct iso_fs *fs = container_of(inode->fs, struct iso_fs, fs);
+  size_t cnt = align_up(inode->size, ISO_BLOCK_SIZE) / ISO_BLOCK_SIZE;
+
+  return block_map(fs->bd, inode->ino, cnt);
+}
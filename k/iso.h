@@ -0,0 +1,35 @@
+#ifndef ISO_H
+#define ISO_H
+
+#include <k/blockdev.h>
+#include <k/kstd.h>
+#include <k/types.h>
+
+#include <k/iso9660.h>
+
+#include "vfs.h"
+
+/* in-memory copy of a little endian path table record */
+struct iso_path {
+  u32 data_blk;
+  u16 parent;      /* path table index of the parent directory */
+  u16 first_child; /* path table index of the first subdirectory, 0 if none */
+  u8 idf_len;
+  const char *idf;
+};
+
+struct iso_fs {
+  struct fs fs;
+  struct blockdev *bd;
+  struct iso_path *paths; /* paths[0] is unused, indexes start at 1 */
+  size_t path_cnt;
+  char *path_table;
+  size_t path_table_sz;
+};
+
+int iso_mount(struct iso_fs *fs, struct blockdev *bd);
+int iso_lookup(struct iso_fs *fs, const char *path, struct iso_dir *dir);
+ssize_t iso_read(struct iso_fs *fs, const struct iso_dir *dir, void *buf,
+                 size_t count, off_t off);
+
+#endif /* ISO_H */
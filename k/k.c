@@ -21,13 +21,93 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include <k/kfs.h>
 #include <k/kstd.h>
+#include <string.h>
 
+#include "idt.h"
+#include "iso.h"
+#include "kfs.h"
+#include "ksym.h"
+#include "memory.h"
 #include "multiboot.h"
+#include "panic.h"
+#include "ramdisk.h"
+#include "rom.h"
+#include "vfs.h"
+
+static struct kfs_fs module_fs[RAMDISK_MAX];
+static struct iso_fs module_iso[RAMDISK_MAX];
+static char module_mountpoints[RAMDISK_MAX][VFS_PATH_MAX];
+
+static struct fs *k_mount_module(size_t i, struct ramdisk *rd) {
+  if (!kfs_mount(&module_fs[i], &rd->bd))
+    return &module_fs[i].fs;
+
+  if (!ramdisk_set_blk_size(rd, ISO_BLOCK_SIZE) &&
+      !iso_mount(&module_iso[i], &rd->bd))
+    return &module_iso[i].fs;
+
+  return NULL;
+}
+
+/* module command lines are "<path> <mount point>", images are kfs or iso */
+static void k_mount_modules(void) {
+  struct ramdisk *rd;
+
+  for (size_t i = 0; (rd = ramdisk_get(i)); ++i) {
+    if (!rd->cmdline)
+      continue;
+
+    size_t len = strlen(rd->cmdline);
+    const char *arg = memchr(rd->cmdline, ' ', len);
+    if (!arg)
+      continue;
+
+    len -= ++arg - rd->cmdline;
+    if (!len || len >= VFS_PATH_MAX)
+      continue;
+    memcpy(module_mountpoints[i], arg, len + 1);
+
+    struct fs *fs = k_mount_module(i, rd);
+    if (fs)
+      vfs_mount(fs, module_mountpoints[i]);
+  }
+}
+
+/* the command line is "<kernel path> <rom path>" */
+static const char *k_rom_path(const multiboot_info_t *info) {
+  if (!(info->flags & MULTIBOOT_INFO_CMDLINE) || !info->cmdline)
+    return NULL;
+
+  const char *cmdline = (const char *)info->cmdline;
+  const char *arg = memchr(cmdline, ' ', strlen(cmdline));
+  if (!arg)
+    return NULL;
+
+  while (*arg == ' ')
+    ++arg;
+  return *arg ? arg : NULL;
+}
 
 void k_main(unsigned long magic, multiboot_info_t *info) {
   (void)magic;
-  (void)info;
+
+  idt_init();
+  memory_init(info);
+  ksym_init(info);
+  /* rom assets are shipped as images loaded as multiboot modules */
+  ramdisk_init(info, KFS_BLK_SZ);
+  k_mount_modules();
+
+  /* roms and the libraries they need are modules mounted on /bin and /lib */
+  const char *rom = k_rom_path(info);
+  if (rom) {
+    /* only returns on error */
+    int rc = rom_exec(rom);
+
+    panic("unable to launch %s: %d", rom, rc);
+  }
 
   char star[4] = "|/-\\";
   char *fb = (void *)0xb8000;
@@ -0,0 +1,366 @@
+#include "kfs.h"
+
+#include <k/compiler.h>
+#include <k/lz.h>
+#include <string.h>
+
+#include "memory.h"
+
+/*
+ * KFS images are read-only, so a block checksum only needs to be checked
+ * the first time the block is read: a bitmap remembers verified blocks and
+ * later reads are served without hashing. Inodes are kept in a direct
+ * mapped cache indexed by block number, and as they hold every extent of
+ * their file, mapping any offset needs no other metadata read.
+ *
+ * Compressed files go through their lzmap block instead, and blocks are
+ * decompressed when the page cache is filled. The last decompressed block
+ * is kept, as page and block boundaries do not line up.
+ *
+ * The end of a file, or a whole small compressed file, may be a tail packed
+ * with others in a shared data block: it is read with that single block.
+ */
+
+enum kfs_blk_type {
+  KFS_BLK_DATA,
+  KFS_BLK_INODE,
+  KFS_BLK_INDEX,
+  KFS_BLK_LZMAP,
+};
+
+static int kfs_fs_lookup(struct fs *fs, const char *path, struct inode *inode);
+static ssize_t kfs_fs_read(struct inode *inode, void *buf, size_t count,
+                           off_t off);
+
+static struct fs_ops kfs_fs_ops = {
+    .lookup = kfs_fs_lookup,
+    .read = kfs_fs_read,
+};
+
+static int kfs_verify(const void *blk, enum kfs_blk_type type) {
+  const struct kfs_blk *b = blk;
+
+  switch (type) {
+  case KFS_BLK_DATA:
+    return kfs_block_checksum(&b->blk) == b->blk.cksum;
+  case KFS_BLK_INODE:
+    return kfs_checksum(&b->ino, sizeof(b->ino) - sizeof(b->ino.cksum)) ==
+           b->ino.cksum;
+  case KFS_BLK_INDEX:
+    return kfs_checksum(&b->index,
+                        sizeof(b->index) - sizeof(b->index.cksum)) ==
+           b->index.cksum;
+  case KFS_BLK_LZMAP:
+    return kfs_checksum(&b->lzmap,
+                        sizeof(b->lzmap) - sizeof(b->lzmap.cksum)) ==
+           b->lzmap.cksum;
+  }
+
+  return 0;
+}
+
+/* read a block, checking its checksum on first use */
+static void *kfs_read_blk(struct kfs_fs *fs, u32 idx, enum kfs_blk_type type) {
+  if (!idx || idx >= fs->sb.blk_cnt)
+    return NULL;
+
+  void *blk = block_read(fs->bd, idx);
+  if (!blk)
+    return NULL;
+
+  u32 bit = 1u << (idx % 32);
+  if (fs->verified[idx / 32] & bit)
+    return blk;
+
+  if (!kfs_verify(blk, type)) {
+    block_free(fs->bd, blk);
+    return NULL;
+  }
+  fs->verified[idx / 32] |= bit;
+
+  return blk;
+}
+
+static struct kfs_inode *kfs_get_inode(struct kfs_fs *fs, u32 idx) {
+  struct kfs_icache_entry *e = &fs->icache[idx & (KFS_ICACHE_SIZE - 1)];
+
+  if (e->idx == idx)
+    return &e->inode;
+
+  struct kfs_inode *inode = kfs_read_blk(fs, idx, KFS_BLK_INODE);
+  if (!inode)
+    return NULL;
+
+  e->idx = idx;
+  e->inode = *inode;
+  block_free(fs->bd, inode);
+
+  return &e->inode;
+}
+
+int kfs_mount(struct kfs_fs *fs, struct blockdev *bd) {
+  if (bd->blk_size != KFS_BLK_SZ)
+    return -EINVAL;
+
+  struct kfs_superblock *sb = block_read(bd, 0);
+  if (!sb)
+    return -EIO;
+
+  fs->sb = *sb;
+  block_free(bd, sb);
+
+  if (fs->sb.magic != KFS_MAGIC || fs->sb.version != KFS_VERSION ||
+      kfs_checksum(&fs->sb, sizeof(fs->sb) - sizeof(fs->sb.cksum)) !=
+          fs->sb.cksum)
+    return -EINVAL;
+
+  if (fs->sb.index_idx &&
+      (!fs->sb.index_blk_cnt || fs->sb.index_idx >= fs->sb.blk_cnt ||
+       fs->sb.index_blk_cnt > fs->sb.blk_cnt - fs->sb.index_idx))
+    return -EINVAL;
+
+  size_t bitmap_sz = align_up(fs->sb.blk_cnt, 32) / 8;
+  size_t icache_sz = KFS_ICACHE_SIZE * sizeof(*fs->icache);
+
+  fs->verified = memory_reserve(bitmap_sz);
+  fs->icache = memory_reserve(icache_sz);
+  if (!fs->verified || !fs->icache) {
+    /* the caller tries another filesystem: do not keep half of them */
+    if (fs->verified)
+      memory_release(fs->verified);
+    if (fs->icache)
+      memory_release(fs->icache);
+    return -ENOMEM;
+  }
+
+  memset(fs->verified, 0, bitmap_sz);
+  memset(fs->icache, 0, icache_sz);
+
+  fs->fs.ops = &kfs_fs_ops;
+  fs->bd = bd;
+  fs->lz_buf = NULL;
+  fs->lz_blk = 0;
+
+  return 0;
+}
+
+/* find a file through the filename index: one index block read */
+static int kfs_index_lookup(struct kfs_fs *fs, const char *name, u32 *idx) {
+  u32 hash = kfs_name_hash(name);
+  u32 blk_cnt = fs->sb.index_blk_cnt;
+  struct kfs_index *index =
+      kfs_read_blk(fs, fs->sb.index_idx + hash % blk_cnt, KFS_BLK_INDEX);
+  int rc = -ENOENT;
+
+  if (!index)
+    return -EIO;
+
+  u32 slot = hash / blk_cnt % KFS_INDEX_SLOTS;
+  for (u32 i = 0; i < KFS_INDEX_SLOTS; ++i) {
+    struct kfs_index_entry *e = &index->entries[slot];
+
+    if (!e->inode_idx)
+      break;
+
+    if (e->hash == hash) {
+      struct kfs_inode *ino = kfs_get_inode(fs, e->inode_idx);
+      if (!ino) {
+        rc = -EIO;
+        break;
+      }
+      if (!strncmp(ino->filename, name, KFS_FNAME_SZ)) {
+        *idx = e->inode_idx;
+        rc = 0;
+        break;
+      }
+    }
+
+    slot = (slot + 1) % KFS_INDEX_SLOTS;
+  }
+
+  block_free(fs->bd, index);
+  return rc;
+}
+
+/* find a file by walking the inode chain, for images without an index */
+static int kfs_chain_lookup(struct kfs_fs *fs, const char *name, u32 *idx) {
+  u32 cur = fs->sb.inode_idx;
+
+  for (u32 i = 0; cur && i < fs->sb.inode_cnt; ++i) {
+    struct kfs_inode *ino = kfs_get_inode(fs, cur);
+    if (!ino)
+      return -EIO;
+
+    if (!strncmp(ino->filename, name, KFS_FNAME_SZ)) {
+      *idx = cur;
+      return 0;
+    }
+
+    cur = ino->next_inode;
+  }
+
+  return -ENOENT;
+}
+
+static int kfs_fs_lookup(struct fs *fs, const char *path, struct inode *inode) {
+  struct kfs_fs *kfs = container_of(fs, struct kfs_fs, fs);
+  size_t len = strlen(path);
+  u32 idx;
+  int rc;
+
+  /* kfs has a single flat directory */
+  if (!len || len > KFS_FNAME_SZ || memchr(path, '/', len))
+    return -ENOENT;
+
+  if (kfs->sb.index_idx)
+    rc = kfs_index_lookup(kfs, path, &idx);
+  else
+    rc = kfs_chain_lookup(kfs, path, &idx);
+  if (rc)
+    return rc;
+
+  struct kfs_inode *ino = kfs_get_inode(kfs, idx);
+  if (!ino)
+    return -EIO;
+
+  inode->fs = fs;
+  inode->ino = idx;
+  inode->size = ino->file_sz;
+  return 0;
+}
+
+/* decompress a block, keeping the last one around for the next read */
+static const u8 *kfs_lz_block(struct kfs_fs *fs, const struct kfs_inode *ino,
+                              u32 n, size_t raw_sz) {
+  u32 idx = kfs_bmap(ino, n);
+  u32 src_off = 0;
+
+  /* a compressed file with no block has its data in a packed tail */
+  if (!ino->blk_cnt) {
+    idx = ino->tail_blk;
+    src_off = ino->tail_off;
+  }
+
+  if (idx && fs->lz_blk == idx && fs->lz_off == src_off)
+    return fs->lz_buf;
+
+  if (!fs->lz_buf) {
+    fs->lz_buf = memory_reserve(KFS_LZ_RAW_MAX);
+    if (!fs->lz_buf)
+      return NULL;
+  }
+
+  struct kfs_block *blk = kfs_read_blk(fs, idx, KFS_BLK_DATA);
+  if (!blk)
+    return NULL;
+
+  size_t sz = blk->usage & ~KFS_BLK_LZ;
+  int ok = (blk->usage & KFS_BLK_LZ) && sz <= KFS_BLK_DATA_SZ;
+  if (!ino->blk_cnt) {
+    sz = ino->tail_len;
+    ok = blk->usage <= KFS_BLK_DATA_SZ && src_off <= blk->usage &&
+         sz <= blk->usage - src_off;
+  }
+
+  int rc = -1;
+  if (ok)
+    rc = lz_decompress(blk->data + src_off, sz, fs->lz_buf, KFS_LZ_RAW_MAX);
+  block_free(fs->bd, blk);
+
+  fs->lz_blk = rc >= 0 && (size_t)rc == raw_sz ? idx : 0;
+  fs->lz_off = src_off;
+  return fs->lz_blk ? fs->lz_buf : NULL;
+}
+
+static ssize_t kfs_lz_read(struct kfs_fs *fs, const struct kfs_inode *ino,
+                           void *buf, size_t count, off_t off) {
+  struct kfs_lzmap *map = NULL;
+  size_t done = 0;
+
+  if (ino->lz_map) {
+    map = kfs_read_blk(fs, ino->lz_map, KFS_BLK_LZMAP);
+    if (!map)
+      return -EIO;
+  }
+
+  while (done < count) {
+    size_t pos = off + done;
+    size_t start;
+    size_t end;
+    u32 n;
+
+    if (kfs_lz_find(map, ino, pos, &n, &start, &end))
+      break;
+
+    const u8 *data = kfs_lz_block(fs, ino, n, end - start);
+    if (!data)
+      break;
+
+    size_t len = end - pos;
+    if (len > count - done)
+      len = count - done;
+
+    memcpy((char *)buf + done, data + (pos - start), len);
+    done += len;
+  }
+
+  if (map)
+    block_free(fs->bd, map);
+  return done ? (ssize_t)done : -EIO;
+}
+
+static ssize_t kfs_fs_read(struct inode *inode, void *buf, size_t count,
+                           off_t off) {
+  struct kfs_fs *fs = container_of(inode->fs, struct kfs_fs, fs);
+  struct kfs_inode *ino = kfs_get_inode(fs, inode->ino);
+
+  if (!ino)
+    return -EIO;
+  if (off < 0)
+    return -EINVAL;
+  if ((size_t)off >= ino->file_sz)
+    return 0;
+  if (count > ino->file_sz - off)
+    count = ino->file_sz - off;
+
+  if (ino->flags & KFS_INODE_LZ)
+    return kfs_lz_read(fs, ino, buf, count, off);
+
+  size_t done = 0;
+  while (done < count) {
+    size_t pos = off + done;
+    size_t n = pos / KFS_BLK_DATA_SZ;
+    size_t blk_off = pos % KFS_BLK_DATA_SZ;
+    size_t end = KFS_BLK_DATA_SZ;
+    u32 idx = kfs_bmap(ino, n);
+
+    /* past its blocks, the rest of the file is a packed tail */
+    if (n >= ino->blk_cnt) {
+      idx = ino->tail_blk;
+      blk_off = ino->tail_off + (pos - ino->blk_cnt * KFS_BLK_DATA_SZ);
+      end = ino->tail_off + ino->tail_len;
+    }
+
+    struct kfs_block *blk = kfs_read_blk(fs, idx, KFS_BLK_DATA);
+    if (blk && n < ino->blk_cnt)
+      end = blk->usage;
+
+    if (!blk || blk->usage > KFS_BLK_DATA_SZ || end > blk->usage ||
+        blk_off >= end) {
+      if (blk)
+        block_free(fs->bd, blk);
+      return done ? (ssize_t)done : -EIO;
+    }
+
+    size_t len = end - blk_off;
+    if (len > count - done)
+      len = count - done;
+
+    memcpy((char *)buf + done, blk->data + blk_off, len);
+    block_free(fs->bd, blk);
+
+    done += len;
+  }
+
+  return done;
+}
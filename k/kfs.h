@@ -0,0 +1,29 @@
+#ifndef KFS_H
+#define KFS_H
+
+#include <k/blockdev.h>
+#include <k/kfs.h>
+
+#include "vfs.h"
+
+#define KFS_ICACHE_SIZE 64 /* must be a power of two */
+
+struct kfs_icache_entry {
+  u32 idx; /* 0 when unused, block 0 is the superblock */
+  struct kfs_inode inode;
+};
+
+struct kfs_fs {
+  struct fs fs;
+  struct blockdev *bd;
+  struct kfs_superblock sb;
+  u32 *verified; /* one bit per block whose checksum was checked */
+  struct kfs_icache_entry *icache;
+  u8 *lz_buf; /* last decompressed block, allocated on first use */
+  u32 lz_blk;
+  u32 lz_off; /* offset of the data in lz_blk, for packed tails */
+};
+
+int kfs_mount(struct kfs_fs *fs, struct blockdev *bd);
+
+#endif /* KFS_H */
@@ -0,0 +1,171 @@
+#include "ksym.h"
+
+#include "elf.h"
+#include "memory.h"
+
+/*
+ * Kernel symbols, from the ELF section headers grub passes along with the
+ * .symtab and .strtab it loaded for us. Only what can be symbolized is kept,
+ * sorted by address; names still point into the .strtab grub loaded.
+ */
+
+static struct ksym *ksyms;
+static size_t ksym_cnt;
+
+static const Elf32_Shdr *ksym_shdrs(const multiboot_info_t *info) {
+  if (!(info->flags & MULTIBOOT_INFO_ELF_SHDR) ||
+      info->u.elf_sec.size != sizeof(Elf32_Shdr))
+    return NULL;
+
+  return (const Elf32_Shdr *)info->u.elf_sec.addr;
+}
+
+/* grub loads the sections that are not part of the image next to it */
+u32 ksym_loaded_end(const multiboot_info_t *info) {
+  const Elf32_Shdr *shdrs = ksym_shdrs(info);
+  u32 end = 0;
+
+  if (!shdrs)
+    return 0;
+
+  for (u32 i = 0; i < info->u.elf_sec.num; ++i) {
+    const Elf32_Shdr *shdr = &shdrs[i];
+
+    if (shdr->sh_addr && !(shdr->sh_flags & SHF_ALLOC) &&
+        shdr->sh_addr + shdr->sh_size > end)
+      end = shdr->sh_addr + shdr->sh_size;
+  }
+
+  if (info->u.elf_sec.addr + info->u.elf_sec.num * sizeof(*shdrs) > end)
+    end = info->u.elf_sec.addr + info->u.elf_sec.num * sizeof(*shdrs);
+
+  return end;
+}
+
+/* linker script markers such as _end have no type nor size: skip them */
+static int ksym_keep(const Elf32_Sym *sym, u32 strsz) {
+  if (ELF32_ST_TYPE(sym->st_info) != STT_FUNC &&
+      ELF32_ST_TYPE(sym->st_info) != STT_OBJECT)
+    return 0;
+
+  return sym->st_name && sym->st_name < strsz && sym->st_size &&
+         sym->st_shndx != SHN_UNDEF && sym->st_shndx < SHN_LORESERVE;
+}
+
+/* aliases sort by size, so that lookups find the largest */
+static int ksym_less(const struct ksym *a, const struct ksym *b) {
+  if (a->addr != b->addr)
+    return a->addr < b->addr;
+
+  return a->size < b->size;
+}
+
+static void ksym_sift(struct ksym *syms, size_t i, size_t cnt) {
+  for (size_t child; (child = 2 * i + 1) < cnt; i = child) {
+    if (child + 1 < cnt && ksym_less(&syms[child], &syms[child + 1]))
+      ++child;
+    if (!ksym_less(&syms[i], &syms[child]))
+      return;
+
+    struct ksym tmp = syms[i];
+    syms[i] = syms[child];
+    syms[child] = tmp;
+  }
+}
+
+/* heapsort: no allocation and no recursion, this early */
+static void ksym_sort(struct ksym *syms, size_t cnt) {
+  for (size_t i = cnt / 2; i-- > 0;)
+    ksym_sift(syms, i, cnt);
+
+  for (size_t end = cnt; end-- > 1;) {
+    struct ksym tmp = syms[0];
+    syms[0] = syms[end];
+    syms[end] = tmp;
+    ksym_sift(syms, 0, end);
+  }
+}
+
+void ksym_init(const multiboot_info_t *info) {
+  const Elf32_Shdr *shdrs = ksym_shdrs(info);
+  const Elf32_Shdr *symtab = NULL;
+
+  if (!shdrs)
+    return;
+
+  for (u32 i = 0; i < info->u.elf_sec.num; ++i) {
+    if (shdrs[i].sh_type == SHT_SYMTAB) {
+      symtab = &shdrs[i];
+      break;
+    }
+  }
+
+  if (!symtab || !symtab->sh_addr ||
+      symtab->sh_entsize != sizeof(Elf32_Sym) ||
+      symtab->sh_link >= info->u.elf_sec.num)
+    return;
+
+  const Elf32_Shdr *strtab = &shdrs[symtab->sh_link];
+  if (strtab->sh_type != SHT_STRTAB || !strtab->sh_addr || !strtab->sh_size)
+    return;
+
+  const Elf32_Sym *syms = (const Elf32_Sym *)symtab->sh_addr;
+  const char *strs = (const char *)strtab->sh_addr;
+  u32 sym_cnt = symtab->sh_size / sizeof(*syms);
+  size_t cnt = 0;
+
+  /* the last byte of .strtab is a nul, unless it is corrupted */
+  if (strs[strtab->sh_size - 1])
+    return;
+
+  for (u32 i = 0; i < sym_cnt; ++i)
+    cnt += ksym_keep(&syms[i], strtab->sh_size);
+  if (!cnt)
+    return;
+
+  ksyms = memory_reserve(cnt * sizeof(*ksyms));
+  if (!ksyms)
+    return;
+
+  for (u32 i = 0; i < sym_cnt; ++i) {
+    if (!ksym_keep(&syms[i], strtab->sh_size))
+      continue;
+
+    ksyms[ksym_cnt].addr = syms[i].st_value;
+    ksyms[ksym_cnt].size = syms[i].st_size;
+    ksyms[ksym_cnt].name = strs + syms[i].st_name;
+    ++ksym_cnt;
+  }
+
+  ksym_sort(ksyms, ksym_cnt);
+}
+
+/*
+ * Name of the symbol addr is in, and the offset of addr in it. NULL when
+ * the symbols were not loaded or addr is in none of them.
+ */
+const char *ksym_lookup(u32 addr, u32 *offset) {
+  size_t lo = 0;
+  size_t hi = ksym_cnt;
+
+  /* find the last symbol starting at or before addr */
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (ksyms[mid].addr <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (!lo)
+    return NULL;
+
+  const struct ksym *sym = &ksyms[lo - 1];
+  if (addr - sym->addr >= sym->size)
+    return NULL;
+
+  if (offset)
+    *offset = addr - sym->addr;
+  return sym->name;
+}
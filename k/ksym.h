@@ -0,0 +1,18 @@
+#ifndef KSYM_H
+#define KSYM_H
+
+#include <k/types.h>
+
+#include "multiboot.h"
+
+struct ksym {
+  u32 addr;
+  u32 size;
+  const char *name;
+};
+
+u32 ksym_loaded_end(const multiboot_info_t *info);
+void ksym_init(const multiboot_info_t *info);
+const char *ksym_lookup(u32 addr, u32 *offset);
+
+#endif /* KSYM_H */
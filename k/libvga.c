@@ -160,6 +160,10 @@ static void libvga_write_regs(unsigned char *regs) {
 
   /* write the default palette to the DAC */
   outb(VGA_DAC_MASK, 0xFF);
+  libvga_set_default_palette();
+}
+
+void libvga_set_default_palette(void) {
   libvga_set_palette(libvga_default_palette,
                      array_size(libvga_default_palette));
 }
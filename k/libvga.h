@@ -51,6 +51,8 @@
 
 void libvga_set_palette(unsigned int *new_palette, size_t size);
 
+void libvga_set_default_palette(void);
+
 char *libvga_get_framebuffer(void);
 
 void libvga_switch_mode13h(void);
@@ -0,0 +1,327 @@
+#include "loader.h"
+
+#include <k/compiler.h>
+#include <k/lz.h>
+#include <k/romz.h>
+#include <k/types.h>
+#include <string.h>
+
+#include "dynlink.h"
+#include "elf.h"
+#include "pcache.h"
+
+/*
+ * ELF rom loader. Segments are streamed from the file into their final
+ * place: there is no buffer holding the whole file, only the page cache the
+ * data may already be in. Roms compressed by mkromz, see <k/romz.h>, are
+ * decompressed from the page cache into place as well.
+ */
+
+/*
+ * Copy len bytes of a file from off to dst. Pages already in the page cache
+ * are copied from there, runs of missing pages are read by the filesystem
+ * right into dst without filling the cache: they are only needed once.
+ */
+int elf_copy(struct inode *inode, void *dst, size_t len, size_t off) {
+  char *p = dst;
+
+  while (len) {
+    size_t page_off = off % PAGE_SIZE;
+    size_t n = PAGE_SIZE - page_off < len ? PAGE_SIZE - page_off : len;
+    struct page *page = pcache_find(inode, off / PAGE_SIZE);
+
+    if (page) {
+      memcpy(p, (char *)page->data + page_off, n);
+      pcache_put(page);
+    } else {
+      while (n < len && !(page = pcache_find(inode, (off + n) / PAGE_SIZE)))
+        n += PAGE_SIZE < len - n ? PAGE_SIZE : len - n;
+      if (page)
+        pcache_put(page);
+
+      if (inode->fs->ops->read(inode, p, n, off) != (ssize_t)n)
+        return -EIO;
+    }
+
+    p += n;
+    off += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+/* zero the bss of a segment, a dword at a time */
+void elf_zero(void *dst, size_t len) {
+  char *p = dst;
+
+  for (; len && ((u32)p & 3); --len)
+    *p++ = 0;
+
+  size_t dwords = len / 4;
+  asm volatile("rep stosl"
+               : "+D"(p), "+c"(dwords)
+               : "a"(0)
+               : "memory");
+
+  for (len &= 3; len; --len)
+    *p++ = 0;
+}
+
+int elf_check_ehdr(const Elf32_Ehdr *ehdr, size_t size, int type) {
+  if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+      ehdr->e_ident[EI_CLASS] != ELFCLASS32 ||
+      ehdr->e_ident[EI_DATA] != ELFDATA2LSB ||
+      ehdr->e_ident[EI_VERSION] != EV_CURRENT)
+    return -EINVAL;
+
+  if (ehdr->e_type != type || ehdr->e_machine != EM_386 ||
+      ehdr->e_phentsize != sizeof(Elf32_Phdr) || !ehdr->e_phnum ||
+      ehdr->e_phnum > LOADER_PHDR_MAX)
+    return -EINVAL;
+
+  if (ehdr->e_phoff > size ||
+      ehdr->e_phnum * sizeof(Elf32_Phdr) > size - ehdr->e_phoff)
+    return -EINVAL;
+
+  return 0;
+}
+
+static int elf_check_segment(u32 vaddr, u32 memsz) {
+  if (vaddr < LOADER_BASE || vaddr > LOADER_END ||
+      memsz > LOADER_END - vaddr)
+    return -EINVAL;
+
+  return 0;
+}
+
+static int elf_check_phdr(const Elf32_Phdr *phdr, size_t size) {
+  if (phdr->p_filesz > phdr->p_memsz || phdr->p_offset > size ||
+      phdr->p_filesz > size - phdr->p_offset)
+    return -EINVAL;
+
+  return elf_check_segment(phdr->p_vaddr, phdr->p_memsz);
+}
+
+/* extend the image with a segment, telling whether it holds the entry */
+static int elf_image_add(struct elf_image *img, u32 vaddr, u32 filesz,
+                         u32 memsz) {
+  if (vaddr < img->start)
+    img->start = vaddr;
+  if (vaddr + filesz > img->data_end)
+    img->data_end = vaddr + filesz;
+  if (vaddr + memsz > img->end)
+    img->end = vaddr + memsz;
+
+  return img->entry >= vaddr && img->entry - vaddr < filesz;
+}
+
+static void elf_image_init(struct elf_image *img, u32 entry) {
+  img->entry = entry;
+  img->start = LOADER_END;
+  img->data_end = LOADER_BASE;
+  img->end = LOADER_BASE;
+  img->lib_start = 0;
+  img->lib_data_end = 0;
+  img->lib_end = 0;
+}
+
+/*
+ * Decompress the chunks of a page, from *off up to end, to dst + *done.
+ * *off is left at the next page.
+ */
+static int romz_inflate_page(const char *data, size_t *off, size_t end,
+                             char *dst, size_t *done, size_t filesz) {
+  size_t next = (*off / PAGE_SIZE + 1) * PAGE_SIZE;
+  size_t page_end = next < end ? next : end;
+  size_t pos = *off;
+
+  *off = next;
+
+  while (*done < filesz && page_end - pos >= sizeof(struct romz_chunk)) {
+    struct romz_chunk chunk;
+
+    memcpy(&chunk, data + pos % PAGE_SIZE, sizeof(chunk));
+    pos += sizeof(chunk);
+    if (!chunk.len)
+      break;
+
+    if (chunk.len > page_end - pos || chunk.raw_len > filesz - *done)
+      return -EINVAL;
+    if (lz_decompress(data + pos % PAGE_SIZE, chunk.len, dst + *done,
+                      chunk.raw_len) != chunk.raw_len)
+      return -EINVAL;
+
+    pos += chunk.len;
+    *done += chunk.raw_len;
+  }
+
+  return 0;
+}
+
+/*
+ * Decompress a segment into place. Its pages are brought into the cache
+ * with one read per run of missing pages, and decompressed from there.
+ */
+static int romz_inflate(struct inode *inode, const struct romz_segment *seg) {
+  size_t off = seg->offset;
+  size_t end = seg->offset + seg->size;
+  size_t done = 0;
+
+  while (done < seg->filesz) {
+    if (off >= end)
+      return -EINVAL;
+
+    u32 index = off / PAGE_SIZE;
+    struct page *page = pcache_find(inode, index);
+    if (!page) {
+      pcache_readahead(inode, index, (end - 1) / PAGE_SIZE - index + 1);
+      page = pcache_get(inode, index);
+      if (!page)
+        return -EIO;
+    }
+
+    int rc = romz_inflate_page(page->data, &off, end, (char *)seg->vaddr,
+                               &done, seg->filesz);
+    pcache_put(page);
+    if (rc)
+      return rc;
+  }
+
+  return 0;
+}
+
+/* a mkromz container, chunks being laid out in pages of ROMZ_PAGE_SZ */
+static int romz_load(struct inode *inode, struct elf_image *img) {
+  struct romz_header hdr;
+
+  /* all of the file is needed, in as few reads as possible */
+  pcache_readahead(inode, 0, align_up(inode->size, PAGE_SIZE) / PAGE_SIZE);
+
+  if (inode->size < sizeof(hdr) || elf_copy(inode, &hdr, sizeof(hdr), 0))
+    return -EINVAL;
+  if (!hdr.seg_cnt || hdr.seg_cnt > ROMZ_SEG_MAX)
+    return -EINVAL;
+
+  int has_entry = 0;
+  elf_image_init(img, hdr.entry);
+  for (size_t i = 0; i < hdr.seg_cnt; ++i) {
+    const struct romz_segment *seg = &hdr.segs[i];
+
+    if (seg->filesz > seg->memsz || seg->offset > inode->size ||
+        seg->size > inode->size - seg->offset ||
+        elf_check_segment(seg->vaddr, seg->memsz))
+      return -EINVAL;
+
+    has_entry |= elf_image_add(img, seg->vaddr, seg->filesz, seg->memsz);
+  }
+  if (!has_entry)
+    return -EINVAL;
+
+  for (size_t i = 0; i < hdr.seg_cnt; ++i) {
+    const struct romz_segment *seg = &hdr.segs[i];
+
+    int rc = romz_inflate(inode, seg);
+    if (rc)
+      return rc;
+    elf_zero((char *)seg->vaddr + seg->filesz, seg->memsz - seg->filesz);
+  }
+
+  return hdr.dynamic ? dynlink_rom(img, hdr.dynamic) : 0;
+}
+
+/*
+ * Load the PT_LOAD segments of a rom where they are linked, and tell where
+ * it lies. The headers are all checked before anything is written. A rom
+ * with a PT_DYNAMIC segment is then linked with its shared library.
+ */
+int elf_load(struct inode *inode, struct elf_image *img) {
+  Elf32_Ehdr ehdr;
+  Elf32_Phdr phdrs[LOADER_PHDR_MAX];
+
+  if (inode->size < sizeof(ehdr) ||
+      elf_copy(inode, &ehdr, sizeof(ehdr), 0))
+    return -EINVAL;
+
+  u32 magic;
+  memcpy(&magic, &ehdr, sizeof(magic));
+  if (magic == ROMZ_MAGIC)
+    return romz_load(inode, img);
+
+  int rc = elf_check_ehdr(&ehdr, inode->size, ET_EXEC);
+  if (rc)
+    return rc;
+
+  rc = elf_copy(inode, phdrs, ehdr.e_phnum * sizeof(*phdrs), ehdr.e_phoff);
+  if (rc)
+    return rc;
+
+  int has_entry = 0;
+  u32 dynamic = 0;
+  elf_image_init(img, ehdr.e_entry);
+  for (size_t i = 0; i < ehdr.e_phnum; ++i) {
+    const Elf32_Phdr *phdr = &phdrs[i];
+
+    if (phdr->p_type == PT_DYNAMIC && phdr->p_filesz)
+      dynamic = phdr->p_vaddr;
+    if (phdr->p_type != PT_LOAD)
+      continue;
+    if (elf_check_phdr(phdr, inode->size))
+      return -EINVAL;
+
+    has_entry |=
+        elf_image_add(img, phdr->p_vaddr, phdr->p_filesz, phdr->p_memsz);
+  }
+  if (!has_entry)
+    return -EINVAL;
+
+  for (size_t i = 0; i < ehdr.e_phnum; ++i) {
+    const Elf32_Phdr *phdr = &phdrs[i];
+    void *dst = (void *)phdr->p_vaddr;
+
+    if (phdr->p_type != PT_LOAD)
+      continue;
+
+    rc = elf_copy(inode, dst, phdr->p_filesz, phdr->p_offset);
+    if (rc)
+      return rc;
+    elf_zero((char *)dst + phdr->p_filesz, phdr->p_memsz - phdr->p_filesz);
+  }
+
+  return dynamic ? dynlink_rom(img, dynamic) : 0;
+}
+
+static size_t elf_image_lib_size(const struct elf_image *img, int pristine) {
+  return (pristine ? img->lib_data_end : img->lib_end) - img->lib_start;
+}
+
+/*
+ * Bytes elf_image_save() needs: the memory of the rom and its state of its
+ * shared library. A pristine image leaves out the zeroes past the file data.
+ */
+size_t elf_image_size(const struct elf_image *img, int pristine) {
+  return (pristine ? img->data_end : img->end) - img->start +
+         elf_image_lib_size(img, pristine);
+}
+
+void elf_image_save(const struct elf_image *img, void *buf, int pristine) {
+  size_t size = (pristine ? img->data_end : img->end) - img->start;
+
+  memcpy(buf, (void *)img->start, size);
+  memcpy((char *)buf + size, (void *)img->lib_start,
+         elf_image_lib_size(img, pristine));
+}
+
+void elf_image_restore(const struct elf_image *img, const void *buf,
+                       int pristine) {
+  size_t size = (pristine ? img->data_end : img->end) - img->start;
+
+  memcpy((void *)img->start, buf, size);
+  memcpy((void *)img->lib_start, (const char *)buf + size,
+         elf_image_lib_size(img, pristine));
+
+  if (pristine) {
+    elf_zero((void *)img->data_end, img->end - img->data_end);
+    elf_zero((void *)img->lib_data_end, img->lib_end - img->lib_data_end);
+  }
+}
@@ -0,0 +1,40 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <k/types.h>
+
+#include "elf.h"
+#include "vfs.h"
+
+/* roms are linked from LOADER_BASE, see roms.lds */
+#define LOADER_BASE 0x4000
+#define LOADER_END 0x80000 /* conventional memory left to roms */
+
+#define LOADER_PHDR_MAX 16
+
+/*
+ * Where a loaded rom lies: file data up to data_end, then zeroes to end.
+ * A rom linked with a shared library also owns the writable segment of the
+ * library, lib_start to lib_end, empty otherwise.
+ */
+struct elf_image {
+  u32 entry;
+  u32 start;
+  u32 data_end;
+  u32 end;
+  u32 lib_start;
+  u32 lib_data_end;
+  u32 lib_end;
+};
+
+int elf_load(struct inode *inode, struct elf_image *img);
+int elf_copy(struct inode *inode, void *dst, size_t len, size_t off);
+int elf_check_ehdr(const Elf32_Ehdr *ehdr, size_t size, int type);
+void elf_zero(void *dst, size_t len);
+
+size_t elf_image_size(const struct elf_image *img, int pristine);
+void elf_image_save(const struct elf_image *img, void *buf, int pristine);
+void elf_image_restore(const struct elf_image *img, const void *buf,
+                       int pristine);
+
+#endif /* LOADER_H */
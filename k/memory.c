@@ -3,6 +3,8 @@
 #include <k/types.h>
 #include <stdio.h>
 
+#include "ksym.h"
+
 static struct list memory_map = {&memory_map, &memory_map};
 static struct cache *memory_map_cache;
 static struct cache *metadata_cache;
@@ -148,6 +150,10 @@ void memory_init(multiboot_info_t *info) {
     last_loaded_addr = (u32)_end; /* XXX: needs to align up */
   }
 
+  /* keep the kernel symbols grub loaded, see ksym_init() */
+  if (last_loaded_addr < ksym_loaded_end(info))
+    last_loaded_addr = ksym_loaded_end(info);
+
   /* take the first good memory region */
   unsigned int reservation_addr = last_loaded_addr;
   unsigned int reservation_len =
@@ -0,0 +1,148 @@
+#include "mmap.h"
+
+#include <k/compiler.h>
+
+#include "memory.h"
+#include "pcache.h"
+
+/*
+ * Read-only file mappings. There is no paging, so a mapping is a contiguous
+ * view of the whole file: the file itself when its filesystem can point into
+ * memory (e.g. an ISO9660 image on a ramdisk), a buffer filled once
+ * otherwise. That buffer then backs the page cache of the file so the data
+ * only lives once in memory. Mapping the same file twice shares the same
+ * view.
+ */
+
+static struct mapping mappings[MMAP_MAX];
+
+static struct mmap_table mmap_default;
+struct mmap_table *mmap_current = &mmap_default;
+
+static struct mapping *mmap_find(struct fs *fs, u32 ino) {
+  for (size_t i = 0; i < array_size(mappings); ++i) {
+    struct mapping *m = &mappings[i];
+
+    if (m->refcnt && m->inode.fs == fs && m->inode.ino == ino)
+      return m;
+  }
+
+  return NULL;
+}
+
+/*
+ * Straight from the filesystem: going through the page cache would fill
+ * pages that pcache_attach() then evicts right away.
+ */
+static int mmap_fill(struct inode *inode, void *addr) {
+  for (size_t off = 0; off < inode->size;) {
+    ssize_t rc = inode->fs->ops->read(inode, (char *)addr + off,
+                                      inode->size - off, off);
+    if (rc <= 0)
+      return -EIO;
+    off += rc;
+  }
+
+  return 0;
+}
+
+void *vfs_mmap(struct inode *inode) {
+  struct mapping *m = mmap_find(inode->fs, inode->ino);
+
+  if (m) {
+    m->refcnt++;
+    return m->addr;
+  }
+
+  if (!inode->size)
+    return NULL;
+
+  for (size_t i = 0; i < array_size(mappings) && !m; ++i) {
+    if (!mappings[i].refcnt)
+      m = &mappings[i];
+  }
+  if (!m)
+    return NULL;
+
+  void *addr = NULL;
+  int owned = 0;
+
+  if (inode->fs->ops->mmap)
+    addr = inode->fs->ops->mmap(inode);
+
+  if (!addr) {
+    addr = memory_reserve(inode->size);
+    if (!addr && pcache_shrink(-1))
+      addr = memory_reserve(inode->size);
+    if (!addr)
+      return NULL;
+    owned = 1;
+
+    if (mmap_fill(inode, addr) || pcache_attach(inode, addr)) {
+      memory_release(addr);
+      return NULL;
+    }
+  }
+
+  m->inode = *inode;
+  m->addr = addr;
+  m->size = inode->size;
+  m->refcnt = 1;
+  m->owned = owned;
+
+  return addr;
+}
+
+int vfs_munmap(void *addr) {
+  for (size_t i = 0; i < array_size(mappings); ++i) {
+    struct mapping *m = &mappings[i];
+
+    if (!m->refcnt || m->addr != addr)
+      continue;
+
+    if (!--m->refcnt && m->owned) {
+      pcache_detach(&m->inode);
+      memory_release(addr);
+    }
+
+    return 0;
+  }
+
+  return -EINVAL;
+}
+
+/*
+ * Mappings made on behalf of a rom are recorded in its table, so that they
+ * are released with it rather than leaked when it is replaced or dropped.
+ */
+void *mmap_map(struct mmap_table *t, struct inode *inode) {
+  for (size_t i = 0; i < array_size(t->addrs); ++i) {
+    if (t->addrs[i])
+      continue;
+
+    t->addrs[i] = vfs_mmap(inode);
+    return t->addrs[i];
+  }
+
+  return NULL;
+}
+
+int mmap_unmap(struct mmap_table *t, void *addr) {
+  for (size_t i = 0; addr && i < array_size(t->addrs); ++i) {
+    if (t->addrs[i] != addr)
+      continue;
+
+    t->addrs[i] = NULL;
+    return vfs_munmap(addr);
+  }
+
+  return -EINVAL;
+}
+
+void mmap_unmap_all(struct mmap_table *t) {
+  for (size_t i = 0; i < array_size(t->addrs); ++i) {
+    if (t->addrs[i])
+      vfs_munmap(t->addrs[i]);
+    t->addrs[i] = NULL;
+  }
+}
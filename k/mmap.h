@@ -0,0 +1,33 @@
+#ifndef MMAP_H
+#define MMAP_H
+
+#include "vfs.h"
+
+#define MMAP_MAX 64
+
+struct mapping {
+  struct inode inode;
+  void *addr;
+  size_t size;
+  int refcnt;
+  int owned; /* addr was reserved by us and backs the page cache */
+};
+
+#define MMAP_ROM_MAX 16 /* mappings a rom holds at once */
+
+/* what a rom mapped, each entry holding one reference */
+struct mmap_table {
+  void *addrs[MMAP_ROM_MAX];
+};
+
+/* table of the running rom */
+extern struct mmap_table *mmap_current;
+
+void *vfs_mmap(struct inode *inode);
+int vfs_munmap(void *addr);
+
+void *mmap_map(struct mmap_table *t, struct inode *inode);
+int mmap_unmap(struct mmap_table *t, void *addr);
+void mmap_unmap_all(struct mmap_table *t);
+
+#endif /* MMAP_H */
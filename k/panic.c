@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "ksym.h"
+
 void panic(const char *fmt, ...) {
 
   puts("[!] PANIC: ");
@@ -17,6 +19,11 @@ void panic(const char *fmt, ...) {
   puts(buf);
   puts("\n");
 
+  u32 offset;
+  const char *sym = ksym_lookup((u32)__builtin_return_address(0), &offset);
+  if (sym)
+    printf("[!] called from %s+%#x\n", sym, offset);
+
   for (;;)
     asm volatile("hlt");
 }
@@ -0,0 +1,393 @@
+#include "pcache.h"
+
+#include <k/compiler.h>
+#include <string.h>
+
+#include "memory.h"
+
+/*
+ * Page cache shared by every filesystem. Pages are indexed by (inode, page
+ * offset): each cached file owns a radix tree of its pages, and files are
+ * found through a small hash table. Unpinned pages are recycled in LRU order
+ * once PCACHE_MAX_PAGES is reached, or when memory runs out.
+ */
+
+struct radix_node {
+  void *slots[PCACHE_RADIX_SLOTS];
+};
+
+struct pcache_file {
+  struct list hash_list;
+  struct fs *fs;
+  u32 ino;
+  u32 height;
+  void *root;
+  size_t nrpages;
+};
+
+#define PCACHE_META_NMEMB 64
+
+static struct list buckets[PCACHE_BUCKETS];
+static struct list lru = {&lru, &lru};
+static size_t nrpages;
+static struct cache *page_cache;
+static struct cache *node_cache;
+static struct cache *file_cache;
+
+static struct cache *pcache_cache_new(size_t bsize) {
+  void *base = memory_reserve(PCACHE_META_NMEMB * bsize);
+
+  if (!base)
+    return NULL;
+
+  return cache_new(base, PCACHE_META_NMEMB, bsize);
+}
+
+static int pcache_init(void) {
+  if (page_cache)
+    return 0;
+
+  for (size_t i = 0; i < array_size(buckets); ++i)
+    list_init(&buckets[i]);
+
+  node_cache = pcache_cache_new(sizeof(struct radix_node));
+  file_cache = pcache_cache_new(sizeof(struct pcache_file));
+  page_cache = pcache_cache_new(sizeof(struct page));
+
+  return page_cache && node_cache && file_cache ? 0 : -ENOMEM;
+}
+
+static struct list *pcache_bucket(struct fs *fs, u32 ino) {
+  return &buckets[((size_t)fs ^ ino) % array_size(buckets)];
+}
+
+static struct pcache_file *pcache_file_get(struct inode *inode, int create) {
+  struct list *bucket = pcache_bucket(inode->fs, inode->ino);
+  struct pcache_file *f;
+
+  list_for_each(f, bucket, hash_list) {
+    if (f->fs == inode->fs && f->ino == inode->ino)
+      return f;
+  }
+
+  if (!create)
+    return NULL;
+
+  f = cache_alloc(file_cache);
+  f->fs = inode->fs;
+  f->ino = inode->ino;
+  f->height = 0;
+  f->root = NULL;
+  f->nrpages = 0;
+  list_insert(bucket, &f->hash_list);
+
+  return f;
+}
+
+static void radix_free(void *node, u32 height) {
+  if (!node || !height)
+    return;
+
+  struct radix_node *n = node;
+  for (size_t i = 0; i < PCACHE_RADIX_SLOTS; ++i)
+    radix_free(n->slots[i], height - 1);
+
+  cache_free(node_cache, n);
+}
+
+static void pcache_file_free(struct pcache_file *f) {
+  radix_free(f->root, f->height);
+  list_remove(&f->hash_list);
+  cache_free(file_cache, f);
+}
+
+static u32 radix_capacity(u32 height) {
+  return 1u << (height * PCACHE_RADIX_SHIFT);
+}
+
+static struct radix_node *radix_node_new(void) {
+  struct radix_node *n = cache_alloc(node_cache);
+
+  memset(n, 0, sizeof(*n));
+
+  return n;
+}
+
+/* slot holding the page at index, grown and allocated on demand */
+static void **radix_slot(struct pcache_file *f, u32 index, int create) {
+  while (f->height < PCACHE_RADIX_MAX_HEIGHT &&
+         index >= radix_capacity(f->height)) {
+    if (!create)
+      return NULL;
+
+    if (f->root) {
+      struct radix_node *n = radix_node_new();
+      n->slots[0] = f->root;
+      f->root = n;
+    }
+    f->height++;
+  }
+
+  if (index >= radix_capacity(f->height))
+    return NULL;
+
+  void **slot = &f->root;
+  for (u32 h = f->height; h > 0; --h) {
+    if (!*slot) {
+      if (!create)
+        return NULL;
+      *slot = radix_node_new();
+    }
+
+    u32 shift = (h - 1) * PCACHE_RADIX_SHIFT;
+    struct radix_node *n = *slot;
+    slot = &n->slots[(index >> shift) & (PCACHE_RADIX_SLOTS - 1)];
+  }
+
+  return slot;
+}
+
+static void pcache_evict(struct page *page) {
+  struct pcache_file *f = page->file;
+
+  *radix_slot(f, page->index, 0) = NULL;
+  list_remove(&page->lru);
+
+  if (!(page->flags & PAGE_FOREIGN)) {
+    memory_release(page->data);
+    nrpages--;
+  }
+  cache_free(page_cache, page);
+
+  if (!--f->nrpages)
+    pcache_file_free(f);
+}
+
+size_t pcache_shrink(size_t nr) {
+  size_t done = 0;
+  struct list *l = lru.prev;
+
+  while (l != &lru && done < nr) {
+    struct page *page = container_of(l, struct page, lru);
+
+    l = l->prev;
+    if (page->refcnt)
+      continue;
+
+    pcache_evict(page);
+    done++;
+  }
+
+  return done;
+}
+
+static struct page *pcache_insert(struct inode *inode, u32 index, void *data,
+                                  int flags) {
+  struct pcache_file *f = pcache_file_get(inode, 1);
+  void **slot = radix_slot(f, index, 1);
+
+  if (!slot) {
+    if (!f->nrpages)
+      pcache_file_free(f);
+    return NULL;
+  }
+
+  struct page *page = cache_alloc(page_cache);
+  page->file = f;
+  page->index = index;
+  page->refcnt = 1;
+  page->flags = flags;
+  page->data = data;
+  list_insert(&lru, &page->lru);
+
+  *slot = page;
+  f->nrpages++;
+  if (!(flags & PAGE_FOREIGN))
+    nrpages++;
+
+  return page;
+}
+
+struct page *pcache_find(struct inode *inode, u32 index) {
+  if (!page_cache)
+    return NULL;
+
+  struct pcache_file *f = pcache_file_get(inode, 0);
+  if (!f)
+    return NULL;
+
+  void **slot = radix_slot(f, index, 0);
+  if (!slot || !*slot)
+    return NULL;
+
+  struct page *page = *slot;
+  page->refcnt++;
+  list_remove(&page->lru);
+  list_insert(&lru, &page->lru);
+
+  return page;
+}
+
+static void *pcache_alloc_data(void) {
+  if (nrpages >= PCACHE_MAX_PAGES)
+    pcache_shrink(1);
+
+  void *data = memory_reserve(PAGE_SIZE);
+  if (!data && pcache_shrink(1))
+    data = memory_reserve(PAGE_SIZE);
+
+  return data;
+}
+
+/* bytes of the file backed by the page at index */
+static size_t pcache_page_len(struct inode *inode, u32 index) {
+  size_t off = index * PAGE_SIZE;
+
+  return inode->size - off < PAGE_SIZE ? inode->size - off : PAGE_SIZE;
+}
+
+/* insert an unpinned copy of a page read elsewhere */
+static int pcache_fill(struct inode *inode, u32 index, const void *src) {
+  void *data = pcache_alloc_data();
+  if (!data)
+    return -ENOMEM;
+
+  size_t len = pcache_page_len(inode, index);
+  memcpy(data, src, len);
+  memset((char *)data + len, 0, PAGE_SIZE - len);
+
+  struct page *page = pcache_insert(inode, index, data, 0);
+  if (!page) {
+    memory_release(data);
+    return -ENOMEM;
+  }
+  pcache_put(page);
+
+  return 0;
+}
+
+struct page *pcache_get(struct inode *inode, u32 index) {
+  struct page *page = pcache_find(inode, index);
+
+  if (page)
+    return page;
+
+  size_t off = index * PAGE_SIZE;
+  if (off >= inode->size || pcache_init())
+    return NULL;
+
+  void *data = pcache_alloc_data();
+  if (!data)
+    return NULL;
+
+  size_t len = pcache_page_len(inode, index);
+  if (inode->fs->ops->read(inode, data, len, off) != (ssize_t)len) {
+    memory_release(data);
+    return NULL;
+  }
+  memset((char *)data + len, 0, PAGE_SIZE - len);
+
+  page = pcache_insert(inode, index, data, 0);
+  if (!page)
+    memory_release(data);
+
+  return page;
+}
+
+static char ra_buf[PCACHE_RA_MAX * PAGE_SIZE];
+
+/*
+ * Bring up to nr pages from index into the cache. Each run of missing pages
+ * is read with one filesystem call through a bounce buffer, then split into
+ * pages.
+ */
+void pcache_readahead(struct inode *inode, u32 index, u32 nr) {
+  u32 end = align_up(inode->size, PAGE_SIZE) / PAGE_SIZE;
+
+  if (nr > PCACHE_RA_MAX)
+    nr = PCACHE_RA_MAX;
+  if (index >= end || pcache_init())
+    return;
+  if (nr > end - index)
+    nr = end - index;
+
+  for (u32 i = index; i < index + nr;) {
+    struct page *page = pcache_find(inode, i);
+
+    if (page) {
+      pcache_put(page);
+      i++;
+      continue;
+    }
+
+    u32 run = 1;
+    while (i + run < index + nr && !(page = pcache_find(inode, i + run)))
+      run++;
+    if (page)
+      pcache_put(page);
+
+    size_t off = i * PAGE_SIZE;
+    size_t len = (run - 1) * PAGE_SIZE + pcache_page_len(inode, i + run - 1);
+    if (inode->fs->ops->read(inode, ra_buf, len, off) != (ssize_t)len)
+      return;
+
+    for (u32 j = 0; j < run; ++j) {
+      if (pcache_fill(inode, i + j, ra_buf + j * PAGE_SIZE))
+        return;
+    }
+
+    i += run;
+  }
+}
+
+void pcache_put(struct page *page) { page->refcnt--; }
+
+/*
+ * Make the pages of a whole file point into buf, so that a file mapping and
+ * read() share the same copy of the data. The pages stay pinned until
+ * pcache_detach().
+ */
+int pcache_attach(struct inode *inode, void *buf) {
+  if (pcache_init())
+    return -ENOMEM;
+
+  u32 cnt = align_up(inode->size, PAGE_SIZE) / PAGE_SIZE;
+
+  for (u32 i = 0; i < cnt; ++i) {
+    struct page *page = pcache_find(inode, i);
+
+    if (page) {
+      if (--page->refcnt) {
+        pcache_detach(inode);
+        return -EAGAIN;
+      }
+      pcache_evict(page);
+    }
+
+    if (!pcache_insert(inode, i, (char *)buf + i * PAGE_SIZE,
+                       PAGE_FOREIGN)) {
+      pcache_detach(inode);
+      return -ENOMEM;
+    }
+  }
+
+  return 0;
+}
+
+void pcache_detach(struct inode *inode) {
+  u32 cnt = align_up(inode->size, PAGE_SIZE) / PAGE_SIZE;
+
+  for (u32 i = 0; i < cnt; ++i) {
+    struct page *page = pcache_find(inode, i);
+
+    if (!page)
+      continue;
+
+    if (page->flags & PAGE_FOREIGN) {
+      page->refcnt = 0;
+      pcache_evict(page);
+    } else {
+      pcache_put(page);
+    }
+  }
+}
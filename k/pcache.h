@@ -0,0 +1,40 @@
+#ifndef PCACHE_H
+#define PCACHE_H
+
+#include "list.h"
+#include "vfs.h"
+
+#define PAGE_SIZE 4096
+
+#define PCACHE_MAX_PAGES 1024 /* owned pages kept before recycling */
+#define PCACHE_DIRECT_PAGES 16 /* uncached runs read around the cache */
+#define PCACHE_BUCKETS 32
+#define PCACHE_RA_MAX 32 /* pages filled by a single readahead transfer */
+
+#define PCACHE_RADIX_SHIFT 6
+#define PCACHE_RADIX_SLOTS (1 << PCACHE_RADIX_SHIFT)
+#define PCACHE_RADIX_MAX_HEIGHT 4
+
+/* the page data belongs to someone else, e.g. a file mapping */
+#define PAGE_FOREIGN (1 << 0)
+
+struct pcache_file;
+
+struct page {
+  struct list lru;
+  struct pcache_file *file;
+  u32 index;
+  int refcnt;
+  int flags;
+  void *data;
+};
+
+struct page *pcache_find(struct inode *inode, u32 index);
+struct page *pcache_get(struct inode *inode, u32 index);
+void pcache_put(struct page *page);
+void pcache_readahead(struct inode *inode, u32 index, u32 nr);
+int pcache_attach(struct inode *inode, void *buf);
+void pcache_detach(struct inode *inode);
+size_t pcache_shrink(size_t nr);
+
+#endif /* PCACHE_H */
@@ -0,0 +1,110 @@
+#include "ramdisk.h"
+
+#include <k/compiler.h>
+#include <k/kstd.h>
+#include <string.h>
+
+/*
+ * Block devices backed by memory, typically a multiboot module that grub
+ * already loaded for us. Blocks are never copied: reading a block returns a
+ * pointer right into the module, and freeing it is a no-op.
+ */
+
+static struct ramdisk ramdisks[RAMDISK_MAX];
+static size_t ramdisk_cnt;
+
+static void *ramdisk_read(struct blockdev *bd, size_t lba) {
+  struct ramdisk *rd = (struct ramdisk *)bd;
+
+  if (lba >= rd->blk_cnt)
+    return NULL;
+
+  return (char *)bd->blocks + lba * bd->blk_size;
+}
+
+static void ramdisk_free_blk(struct blockdev *bd, void *ptr) {
+  (void)bd;
+  (void)ptr;
+}
+
+static size_t ramdisk_read_blks(struct blockdev *bd, size_t lba, size_t cnt,
+                                void *buf) {
+  struct ramdisk *rd = (struct ramdisk *)bd;
+
+  if (lba >= rd->blk_cnt)
+    return 0;
+  if (cnt > rd->blk_cnt - lba)
+    cnt = rd->blk_cnt - lba;
+
+  memcpy(buf, (char *)bd->blocks + lba * bd->blk_size, cnt * bd->blk_size);
+
+  return cnt;
+}
+
+static void *ramdisk_map(struct blockdev *bd, size_t lba, size_t cnt) {
+  struct ramdisk *rd = (struct ramdisk *)bd;
+
+  if (lba >= rd->blk_cnt || cnt > rd->blk_cnt - lba)
+    return NULL;
+
+  return (char *)bd->blocks + lba * bd->blk_size;
+}
+
+static struct blk_ops ramdisk_ops = {
+    .read = ramdisk_read,
+    .free_blk = ramdisk_free_blk,
+    .read_blks = ramdisk_read_blks,
+    .map = ramdisk_map,
+};
+
+struct blockdev *ramdisk_new(void *base, size_t size, size_t blk_size) {
+  if (ramdisk_cnt >= array_size(ramdisks))
+    return NULL;
+
+  struct ramdisk *rd = &ramdisks[ramdisk_cnt++];
+
+  rd->bd.blk_size = blk_size;
+  rd->bd.ops = &ramdisk_ops;
+  rd->bd.blocks = base;
+  rd->blk_cnt = size / blk_size;
+  rd->size = size;
+  rd->cmdline = NULL;
+
+  return &rd->bd;
+}
+
+/* the same memory seen with other blocks, e.g. for another filesystem */
+int ramdisk_set_blk_size(struct ramdisk *rd, size_t blk_size) {
+  if (!blk_size || rd->size < blk_size)
+    return -EINVAL;
+
+  rd->bd.blk_size = blk_size;
+  rd->blk_cnt = rd->size / blk_size;
+
+  return 0;
+}
+
+void ramdisk_init(multiboot_info_t *info, size_t blk_size) {
+  if (!(info->flags & MULTIBOOT_INFO_MODS))
+    return;
+
+  multiboot_module_t *mods = (void *)info->mods_addr;
+
+  /* module memory is already reserved by memory_init() */
+  for (size_t i = 0; i < info->mods_count; ++i) {
+    struct blockdev *bd =
+        ramdisk_new((void *)mods[i].mod_start,
+                    mods[i].mod_end - mods[i].mod_start, blk_size);
+    if (!bd)
+      break;
+
+    ((struct ramdisk *)bd)->cmdline = (const char *)mods[i].cmdline;
+  }
+}
+
+struct ramdisk *ramdisk_get(size_t idx) {
+  if (idx >= ramdisk_cnt)
+    return NULL;
+
+  return &ramdisks[idx];
+}
@@ -0,0 +1,22 @@
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include <k/blockdev.h>
+
+#include "multiboot.h"
+
+#define RAMDISK_MAX 8
+
+struct ramdisk {
+  struct blockdev bd;
+  size_t blk_cnt;
+  size_t size;
+  const char *cmdline;
+};
+
+struct blockdev *ramdisk_new(void *base, size_t size, size_t blk_size);
+void ramdisk_init(multiboot_info_t *info, size_t blk_size);
+int ramdisk_set_blk_size(struct ramdisk *rd, size_t blk_size);
+struct ramdisk *ramdisk_get(size_t idx);
+
+#endif /* RAMDISK_H */
@@ -0,0 +1,208 @@
+#include "rom.h"
+
+#include <k/compiler.h>
+
+#include "exec.h"
+#include "memory.h"
+#include "pcache.h"
+
+/*
+ * Resident roms. Every rom is linked at LOADER_BASE and there is no paging,
+ * so only one of them can be in place at a time: the others are suspended,
+ * their memory swapped out to a buffer of their own. Each rom runs on its
+ * own stack, which stays where it is, and has its own file descriptors and
+ * mappings. Switching to a resident rom swaps the memory of both roms, the
+ * screen and the stack, which is a few dozen KiB of copies and no file
+ * access.
+ */
+
+static struct rom roms[ROM_MAX];
+static struct rom *rom_current;
+static u32 rom_clock;
+
+void context_switch(u32 *save_esp, u32 esp);
+
+static struct rom *rom_find(struct inode *inode) {
+  for (size_t i = 0; i < array_size(roms); ++i) {
+    if (roms[i].fs == inode->fs && roms[i].ino == inode->ino)
+      return &roms[i];
+  }
+
+  return NULL;
+}
+
+static void rom_drop(struct rom *rom) {
+  mmap_unmap_all(&rom->maps);
+  if (rom->mem)
+    memory_release(rom->mem);
+  rom->mem = NULL;
+  rom->fs = NULL;
+}
+
+/* a free slot, or the least recently run rom to make room from */
+static struct rom *rom_slot_pick(void) {
+  struct rom *lru = NULL;
+
+  for (size_t i = 0; i < array_size(roms); ++i) {
+    struct rom *rom = &roms[i];
+
+    if (rom == rom_current)
+      continue;
+    if (!rom->fs) {
+      lru = rom;
+      break;
+    }
+    if (!lru || rom->last_use < lru->last_use)
+      lru = rom;
+  }
+
+  if (!lru->stack) {
+    lru->stack = memory_reserve(ROM_STACK_SIZE);
+    if (!lru->stack)
+      return NULL;
+  }
+
+  return lru;
+}
+
+/* a free slot, making room by dropping the least recently run rom */
+static struct rom *rom_slot_new(void) {
+  struct rom *rom = rom_slot_pick();
+
+  if (rom && rom->fs)
+    rom_drop(rom);
+  return rom;
+}
+
+static void __attribute__((noreturn)) rom_start(void) {
+  ((void (*)(void))rom_current->img.entry)();
+
+  for (;;)
+    asm volatile("hlt");
+}
+
+/* a rom freshly loaded in place, to be entered through its stack */
+static void rom_init(struct rom *rom, struct inode *inode,
+                     const struct elf_image *img) {
+  u32 *sp = (u32 *)((char *)rom->stack + ROM_STACK_SIZE);
+
+  rom->fs = inode->fs;
+  rom->ino = inode->ino;
+  rom->img = *img;
+  fd_close_all(&rom->fds);
+  mmap_unmap_all(&rom->maps);
+
+  /* what context_switch() pops: ebp, ebx, esi, edi and rom_start() */
+  *--sp = 0;
+  *--sp = (u32)rom_start;
+  for (int i = 0; i < 4; ++i)
+    *--sp = 0;
+  rom->esp = (u32)sp;
+}
+
+static void rom_run(struct rom *rom) {
+  struct rom *prev = rom_current;
+  u32 esp;
+
+  rom->last_use = ++rom_clock;
+  rom_current = rom;
+  fd_current = &rom->fds;
+  mmap_current = &rom->maps;
+
+  context_switch(prev ? &prev->esp : &esp, rom->esp);
+}
+
+/*
+ * Replace the running rom, in its slot. Only returns on error, see
+ * exec_load().
+ */
+int rom_exec(const char *pathname) {
+  struct inode inode;
+  struct elf_image img;
+
+  int rc = vfs_lookup(pathname, &inode);
+  if (rc)
+    return rc;
+
+  struct rom *rom = rom_current ? rom_current : rom_slot_new();
+  if (!rom)
+    return -ENOMEM;
+
+  rc = exec_load(&inode, &img);
+  if (rc)
+    return rc;
+
+  if (rom->mem)
+    memory_release(rom->mem);
+  rom->mem = NULL;
+  rom_init(rom, &inode, &img);
+
+  /* the stack of the replaced rom is not coming back */
+  rom_current = NULL;
+  rom_run(rom);
+  __builtin_unreachable();
+}
+
+static int rom_suspend(struct rom *rom) {
+  size_t size = elf_image_size(&rom->img, 0);
+
+  if (!rom->mem) {
+    rom->mem = memory_reserve(size);
+    if (!rom->mem && pcache_shrink(-1))
+      rom->mem = memory_reserve(size);
+    if (!rom->mem)
+      return -ENOMEM;
+  }
+
+  elf_image_save(&rom->img, rom->mem, 0);
+  return video_save(&rom->video);
+}
+
+static void rom_resume(struct rom *rom) {
+  elf_image_restore(&rom->img, rom->mem, 0);
+  video_restore(&rom->video);
+}
+
+/*
+ * Suspend the running rom and run another one, resuming it where it left
+ * off if it is resident. Returns once the caller is resumed in turn.
+ */
+int rom_switch(const char *pathname) {
+  struct rom *cur = rom_current;
+  struct inode inode;
+  struct elf_image img;
+
+  int rc = vfs_lookup(pathname, &inode);
+  if (rc)
+    return rc;
+
+  struct rom *rom = rom_find(&inode);
+  int resident = rom != NULL;
+
+  if (rom == cur && cur)
+    return 0;
+  if (!resident && !(rom = rom_slot_pick()))
+    return -ENOMEM;
+
+  if (cur && (rc = rom_suspend(cur)))
+    return rc;
+
+  if (resident) {
+    rom_resume(rom);
+  } else {
+    /* only dropped once cur is safe, a failed suspend loses nothing */
+    if (rom->fs)
+      rom_drop(rom);
+
+    rc = exec_load(&inode, &img);
+    if (rc) {
+      if (cur)
+        rom_resume(cur);
+      return rc;
+    }
+    rom_init(rom, &inode, &img);
+  }
+
+  rom_run(rom);
+  return 0;
+}
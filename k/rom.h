@@ -0,0 +1,28 @@
+#ifndef ROM_H
+#define ROM_H
+
+#include "fd.h"
+#include "loader.h"
+#include "mmap.h"
+#include "video.h"
+
+#define ROM_MAX 4 /* roms resident at once */
+#define ROM_STACK_SIZE 16384
+
+struct rom {
+  struct fs *fs; /* NULL when the slot is free */
+  u32 ino;
+  u32 last_use;
+  struct elf_image img;
+  void *mem; /* img, while suspended, see elf_image_save() */
+  void *stack;
+  u32 esp; /* saved while suspended */
+  struct fd_table fds;
+  struct mmap_table maps;
+  struct video_state video;
+};
+
+int rom_exec(const char *pathname);
+int rom_switch(const char *pathname);
+
+#endif /* ROM_H */
@@ -0,0 +1,157 @@
+#include "syscalls.h"
+
+#include <k/kstd.h>
+
+#include <string.h>
+
+#include "fd.h"
+#include "mmap.h"
+#include "rom.h"
+#include "video.h"
+#include "vfs.h"
+
+/*
+ * System call table, indexed by the SYSCALL_* numbers of <k/kstd.h>.
+ * Arguments are passed in ebx, ecx and edx and the result in eax.
+ */
+
+typedef u32 (*syscall_t)(u32 ebx, u32 ecx, u32 edx);
+
+static u32 sys_open(u32 ebx, u32 ecx, u32 edx) {
+  const char *pathname = (const char *)ebx;
+  int flags = ecx;
+  struct inode inode;
+
+  (void)edx;
+
+  if (flags != O_RDONLY)
+    return -EINVAL;
+
+  int rc = vfs_lookup(pathname, &inode);
+  if (rc)
+    return rc;
+
+  return fd_open(fd_current, &inode);
+}
+
+static u32 sys_read(u32 ebx, u32 ecx, u32 edx) {
+  struct file *file = fd_get(fd_current, ebx);
+
+  if (!file)
+    return -EBADF;
+
+  return file_read(file, (void *)ecx, edx);
+}
+
+static u32 sys_seek(u32 ebx, u32 ecx, u32 edx) {
+  struct file *file = fd_get(fd_current, ebx);
+
+  if (!file)
+    return -EBADF;
+
+  return file_seek(file, ecx, edx);
+}
+
+static u32 sys_close(u32 ebx, u32 ecx, u32 edx) {
+  (void)ecx;
+  (void)edx;
+
+  return fd_close(fd_current, ebx);
+}
+
+static u32 sys_mmap(u32 ebx, u32 ecx, u32 edx) {
+  const char *pathname = (const char *)ebx;
+  size_t *length = (size_t *)ecx;
+  struct inode inode;
+
+  (void)edx;
+
+  if (vfs_lookup(pathname, &inode))
+    return 0;
+
+  void *addr = mmap_map(mmap_current, &inode);
+  if (addr && length)
+    *length = inode.size;
+
+  return (u32)addr;
+}
+
+static u32 sys_munmap(u32 ebx, u32 ecx, u32 edx) {
+  (void)ecx;
+  (void)edx;
+
+  return mmap_unmap(mmap_current, (void *)ebx);
+}
+
+static u32 sys_setvideo(u32 ebx, u32 ecx, u32 edx) {
+  (void)ecx;
+  (void)edx;
+
+  return video_setmode(ebx);
+}
+
+static u32 sys_swap_frontbuffer(u32 ebx, u32 ecx, u32 edx) {
+  (void)ecx;
+  (void)edx;
+
+  video_swap_frontbuffer((const void *)ebx);
+  return 0;
+}
+
+static u32 sys_setpalette(u32 ebx, u32 ecx, u32 edx) {
+  (void)edx;
+
+  return video_set_palette((const unsigned int *)ebx, ecx);
+}
+
+/* the path lives in the rom about to be swapped out */
+static int sys_copy_path(char *pathname, u32 ebx) {
+  size_t len = strnlen((const char *)ebx, VFS_PATH_MAX);
+
+  if (len == VFS_PATH_MAX)
+    return -EINVAL;
+  memcpy(pathname, (const char *)ebx, len + 1);
+
+  return 0;
+}
+
+static u32 sys_exec(u32 ebx, u32 ecx, u32 edx) {
+  char pathname[VFS_PATH_MAX];
+
+  (void)ecx;
+  (void)edx;
+
+  int rc = sys_copy_path(pathname, ebx);
+  return rc ? rc : rom_exec(pathname);
+}
+
+static u32 sys_switch(u32 ebx, u32 ecx, u32 edx) {
+  char pathname[VFS_PATH_MAX];
+
+  (void)ecx;
+  (void)edx;
+
+  int rc = sys_copy_path(pathname, ebx);
+  return rc ? rc : rom_switch(pathname);
+}
+
+static syscall_t syscalls[NR_SYSCALL] = {
+    [SYSCALL_OPEN] = sys_open,
+    [SYSCALL_READ] = sys_read,
+    [SYSCALL_SEEK] = sys_seek,
+    [SYSCALL_CLOSE] = sys_close,
+    [SYSCALL_SETVIDEO] = sys_setvideo,
+    [SYSCALL_SWAP_FRONTBUFFER] = sys_swap_frontbuffer,
+    [SYSCALL_SETPALETTE] = sys_setpalette,
+    [SYSCALL_MMAP] = sys_mmap,
+    [SYSCALL_MUNMAP] = sys_munmap,
+    [SYSCALL_EXEC] = sys_exec,
+    [SYSCALL_SWITCH] = sys_switch,
+};
+
+u32 syscall_dispatch(u32 nr, u32 ebx, u32 ecx, u32 edx) {
+  if (nr >= NR_SYSCALL || !syscalls[nr])
+    return -ENOSYS;
+
+  return syscalls[nr](ebx, ecx, edx);
+}
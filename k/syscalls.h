@@ -0,0 +1,8 @@
+#ifndef SYSCALLS_H
+#define SYSCALLS_H
+
+#include <k/types.h>
+
+u32 syscall_dispatch(u32 nr, u32 ebx, u32 ecx, u32 edx);
+
+#endif /* SYSCALLS_H */
@@ -0,0 +1,162 @@
+#include "vfs.h"
+
+#include <k/compiler.h>
+#include <string.h>
+
+#include "dcache.h"
+#include "pcache.h"
+
+static struct fs *mounts[VFS_MOUNT_MAX];
+static size_t mount_cnt;
+
+int vfs_mount(struct fs *fs, const char *mountpoint) {
+  if (mount_cnt >= array_size(mounts))
+    return -ENOMEM;
+
+  fs->mountpoint = mountpoint;
+  fs->mountpoint_len = strlen(mountpoint);
+  mounts[mount_cnt++] = fs;
+
+  /* negative entries below the new mount point are now stale */
+  dcache_flush();
+
+  return 0;
+}
+
+/* longest mount point prefixing path */
+static struct fs *vfs_find_mount(const char *path) {
+  struct fs *best = NULL;
+
+  for (size_t i = 0; i < mount_cnt; ++i) {
+    struct fs *fs = mounts[i];
+
+    if (strncmp(path, fs->mountpoint, fs->mountpoint_len))
+      continue;
+    if (!best || fs->mountpoint_len > best->mountpoint_len)
+      best = fs;
+  }
+
+  return best;
+}
+
+/* collapse repeated slashes, RES_PATH "/res/..." yields "/usr/<rom>//res" */
+static int vfs_normalize(const char *path, char *buf) {
+  size_t len = 0;
+
+  for (; *path; ++path) {
+    if (*path == '/' && len && buf[len - 1] == '/')
+      continue;
+    if (len == VFS_PATH_MAX - 1)
+      return -EINVAL;
+    buf[len++] = *path;
+  }
+  buf[len] = '\0';
+
+  return 0;
+}
+
+int vfs_lookup(const char *pathname, struct inode *inode) {
+  char path[VFS_PATH_MAX];
+
+  if (vfs_normalize(pathname, path))
+    return -EINVAL;
+
+  u32 hash = dcache_hash(path);
+  struct dentry *d = dcache_lookup(path, hash);
+
+  if (d) {
+    if (d->negative)
+      return -ENOENT;
+    *inode = d->inode;
+    return 0;
+  }
+
+  struct fs *fs = vfs_find_mount(path);
+  int rc = -ENOENT;
+
+  if (fs)
+    rc = fs->ops->lookup(fs, path + fs->mountpoint_len, inode);
+
+  if (!rc)
+    dcache_insert(path, hash, inode);
+  else if (rc == -ENOENT)
+    dcache_insert(path, hash, NULL);
+
+  return rc;
+}
+
+/* number of consecutive uncached pages from index, up to max */
+static u32 vfs_uncached_run(struct inode *inode, u32 index, u32 max) {
+  u32 run = 0;
+
+  for (; run < max; ++run) {
+    struct page *page = pcache_find(inode, index + run);
+
+    if (page) {
+      pcache_put(page);
+      break;
+    }
+  }
+
+  return run;
+}
+
+/*
+ * Reads go through the page cache, except for long uncached runs of whole
+ * pages which are handed to the filesystem in one go so that large assets
+ * are streamed with big transfers and do not flush the cache.
+ */
+ssize_t vfs_read(struct inode *inode, void *buf, size_t count, off_t off) {
+  if (off < 0)
+    return -EINVAL;
+  if (!count || (size_t)off >= inode->size)
+    return 0;
+  if (count > inode->size - off)
+    count = inode->size - off;
+
+  char *dst = buf;
+  size_t pos = off;
+  size_t end = off + count;
+
+  while (pos < end) {
+    u32 index = pos / PAGE_SIZE;
+    size_t page_off = pos % PAGE_SIZE;
+
+    if (!page_off && end - pos >= PCACHE_DIRECT_PAGES * PAGE_SIZE) {
+      u32 max = (end - pos) / PAGE_SIZE;
+      u32 run = vfs_uncached_run(inode, index, max);
+
+      if (run >= PCACHE_DIRECT_PAGES) {
+        size_t len = run * PAGE_SIZE;
+        ssize_t rc = inode->fs->ops->read(inode, dst, len, pos);
+
+        if (rc > 0) {
+          dst += rc;
+          pos += rc;
+        }
+        if (rc != (ssize_t)len)
+          break;
+        continue;
+      }
+    }
+
+    struct page *page = pcache_get(inode, index);
+    if (!page)
+      break;
+
+    size_t len = PAGE_SIZE - page_off;
+    if (len > end - pos)
+      len = end - pos;
+
+    memcpy(dst, (char *)page->data + page_off, len);
+    pcache_put(page);
+
+    dst += len;
+    pos += len;
+  }
+
+  if (pos == (size_t)off)
+    return -EIO;
+
+  return pos - off;
+}
@@ -0,0 +1,36 @@
+#ifndef VFS_H
+#define VFS_H
+
+#include <k/kstd.h>
+#include <k/types.h>
+
+#define VFS_MOUNT_MAX 8
+#define VFS_PATH_MAX 256
+
+struct fs;
+
+struct inode {
+  struct fs *fs;
+  u32 ino; /* filesystem specific location of the file */
+  u32 size;
+};
+
+struct fs_ops {
+  /* path is relative to the mount point */
+  int (*lookup)(struct fs *fs, const char *path, struct inode *inode);
+  ssize_t (*read)(struct inode *inode, void *buf, size_t count, off_t off);
+  /* optional, file contents if they already are contiguous in memory */
+  void *(*mmap)(struct inode *inode);
+};
+
+struct fs {
+  struct fs_ops *ops;
+  const char *mountpoint;
+  size_t mountpoint_len;
+};
+
+int vfs_mount(struct fs *fs, const char *mountpoint);
+int vfs_lookup(const char *pathname, struct inode *inode);
+ssize_t vfs_read(struct inode *inode, void *buf, size_t count, off_t off);
+
+#endif /* VFS_H */
@@ -0,0 +1,81 @@
+#include "video.h"
+
+#include <k/kstd.h>
+#include <string.h>
+
+#include "libvga.h"
+#include "memory.h"
+
+/*
+ * The VGA state set through the video system calls. It is tracked here so
+ * that a suspended rom gets its screen back as it left it: mode, palette
+ * and framebuffer contents.
+ */
+
+static struct video_state video = {.mode = VIDEO_TEXT};
+
+static size_t video_fb_size(int mode) {
+  return mode == VIDEO_GRAPHIC ? VIDEO_GRAPHIC_FB_SIZE : VIDEO_TEXT_FB_SIZE;
+}
+
+int video_setmode(int mode) {
+  if (mode != VIDEO_GRAPHIC && mode != VIDEO_TEXT)
+    return -EINVAL;
+  if (mode == video.mode)
+    return 0;
+
+  if (mode == VIDEO_GRAPHIC)
+    libvga_switch_mode13h();
+  else
+    libvga_switch_mode3h();
+
+  /* switching mode writes the default palette */
+  video.mode = mode;
+  video.palette_sz = 0;
+
+  return 0;
+}
+
+int video_set_palette(const unsigned int *palette, size_t size) {
+  if (size > VIDEO_PALETTE_MAX)
+    return -EINVAL;
+
+  memcpy(video.palette, palette, size * sizeof(*palette));
+  video.palette_sz = size;
+  libvga_set_palette(video.palette, size);
+
+  return 0;
+}
+
+void video_swap_frontbuffer(const void *buffer) {
+  if (video.mode == VIDEO_GRAPHIC)
+    memcpy(libvga_get_framebuffer(), buffer, VIDEO_GRAPHIC_FB_SIZE);
+}
+
+int video_save(struct video_state *state) {
+  void *fb = state->fb;
+
+  if (!fb) {
+    fb = memory_reserve(VIDEO_GRAPHIC_FB_SIZE);
+    if (!fb)
+      return -ENOMEM;
+  }
+
+  *state = video;
+  state->fb = fb;
+  memcpy(fb, libvga_get_framebuffer(), video_fb_size(video.mode));
+
+  return 0;
+}
+
+void video_restore(const struct video_state *state) {
+  video_setmode(state->mode);
+
+  if (state->palette_sz)
+    video_set_palette(state->palette, state->palette_sz);
+  else if (video.palette_sz)
+    libvga_set_default_palette();
+  video.palette_sz = state->palette_sz;
+
+  memcpy(libvga_get_framebuffer(), state->fb, video_fb_size(state->mode));
+}
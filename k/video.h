@@ -0,0 +1,26 @@
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include <k/types.h>
+#include <stddef.h>
+
+#define VIDEO_PALETTE_MAX 256
+
+#define VIDEO_GRAPHIC_FB_SIZE (320 * 200)
+#define VIDEO_TEXT_FB_SIZE (80 * 25 * 2)
+
+/* what a rom sees of the screen, saved while it is suspended */
+struct video_state {
+  int mode;
+  size_t palette_sz; /* 0 for the default palette */
+  unsigned int palette[VIDEO_PALETTE_MAX];
+  void *fb; /* framebuffer contents, allocated on first save */
+};
+
+int video_setmode(int mode);
+int video_set_palette(const unsigned int *palette, size_t size);
+void video_swap_frontbuffer(const void *buffer);
+int video_save(struct video_state *state);
+void video_restore(const struct video_state *state);
+
+#endif /* VIDEO_H */
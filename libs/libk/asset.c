@@ -0,0 +1,57 @@
+#include <k/bundle.h>
+#include <kstd.h>
+#include <stddef.h>
+
+/* set by roms.lds around the bundle, empty when the rom has none */
+extern const char __bundle_start[];
+extern const char __bundle_end[];
+
+/**
+ * @brief Compare a path, in which runs of '/' count as one, to a bundle name.
+ */
+static int asset_cmp(const char *path, const char *name)
+{
+	for (; *path && *path == *name; ++path, ++name) {
+		while (*path == '/' && path[1] == '/')
+			++path;
+	}
+
+	return (unsigned char)*path - (unsigned char)*name;
+}
+
+const void *asset_find(const char *path, size_t *size)
+{
+	const struct bundle_header *hdr = (const void *)__bundle_start;
+
+	if ((size_t)(__bundle_end - __bundle_start) < sizeof(*hdr) ||
+	    hdr->magic != BUNDLE_MAGIC)
+		return NULL;
+
+	const struct bundle_entry *entries = (const void *)(hdr + 1);
+	size_t lo = 0;
+	size_t hi = hdr->cnt;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const struct bundle_entry *e = &entries[mid];
+		int cmp = asset_cmp(path, __bundle_start + e->name);
+
+		if (!cmp) {
+			*size = e->size;
+			return __bundle_start + e->offset;
+		}
+
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return NULL;
+}
+
+int asset_owns(const void *addr)
+{
+	return (const char *)addr >= __bundle_start &&
+	       (const char *)addr < __bundle_end;
+}
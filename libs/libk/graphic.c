@@ -441,18 +441,18 @@ struct bitmap_header {
 
  struct image *load_image(const char *path)
 {
-	struct bitmap_header bmp;
-
-	int fd = open(path, 0);
-	if (fd < 0)
+	size_t len;
+	unsigned char *file = mmap(path, &len);
+	if (!file)
 		return NULL;
 
-	int rc = read(fd, &bmp, sizeof(bmp));
-	if (rc < (int)sizeof(bmp)) {
+	/* pixels are used in place, only the row pointers are allocated */
+	struct bitmap_header *bmp = (void *)file;
+	if (len < sizeof(*bmp)) {
 		goto err_img;
 	}
 
-	if (!(bmp.signature[0] == 'B' && bmp.signature[1] == 'M')) {
+	if (!(bmp->signature[0] == 'B' && bmp->signature[1] == 'M')) {
 		goto err_img;
 	}
 
@@ -461,55 +461,40 @@ struct bitmap_header {
 		goto err_img;
 	}
 
-	img->width = bmp.width;
-	img->height = bmp.height;
+	img->width = bmp->width;
+	img->height = bmp->height;
+	img->map = file;
+
+	int ppl = (bmp->size - (img->width * img->height)) / img->height;
+	size_t stride = img->width + ppl;
+
+	if (bmp->offset + (img->height - 1) * stride + img->width > len)
+		goto err_buf;
 
 	img->data = calloc(img->height, sizeof(*img->data));
 	if (!img->data)
 		goto err_buf;
 
-	for (unsigned int i = 0; i < img->height; i++) {
-		img->data[i] = calloc(img->width, sizeof(*img->data[i]));
-		if (!img->data[i])
-			goto err;
-	}
-
-	int ppl = (bmp.size - (img->width * img->height)) / img->height;
-
-	if (lseek(fd, bmp.offset, SEEK_SET) == (off_t) - 1) {
-		goto err;
-	}
-
-	for (unsigned int i = 0; i < img->height; i++) {
-		rc = read(fd, img->data[i], img->width);
-		if (rc < (int)img->width)
-			goto err;
-
-		rc = lseek(fd, ppl, SEEK_CUR);
-
-		if (rc == (off_t)-1)
-			goto err;
-	}
-
-	close(fd);
+	for (unsigned int i = 0; i < img->height; i++)
+		img->data[i] = file + bmp->offset + i * stride;
 
 	return img;
 
-err:
-	for (unsigned int i = 0; i < img->height; i++)
-		free(img->data[i]);
-	free(img->data);
 err_buf:
 	free(img);
 err_img:
-	close(fd);
+	munmap(file);
 	return NULL;
 }
 
 void clear_image( struct image * image)
 {
-	for (unsigned int i = 0; i < image->height; i++)
-		free(image->data[i]);
+	if (image->map) {
+		munmap(image->map);
+	} else {
+		for (unsigned int i = 0; i < image->height; i++)
+			free(image->data[i]);
+	}
 	free(image->data);
 	free(image);
 }
@@ -48,6 +48,7 @@ struct image {
 	unsigned int width;
 	unsigned int height;
 	unsigned char **data;
+	void *map; /* mapped file the rows point into */
 };
 
 /*
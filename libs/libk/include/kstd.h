@@ -16,5 +16,11 @@ void swap_frontbuffer(const void *buffer);
 int playsound(struct melody *melody, int repeat);
 int getmouse(int *x, int *y, int *buttons);
 int getkeymode(int mode);
+void *mmap(const char *pathname, size_t *length);
+int munmap(void *addr);
+int exec(const char *pathname);
+int switchrom(const char *pathname);
+const void *asset_find(const char *path, size_t *size);
+int asset_owns(const void *addr);
 
 #endif
@@ -27,49 +27,46 @@
 struct melody *load_sound(const char *path)
 {
 	struct melody *melody = NULL;
-	int fd = -1;
 	int nb = -1;
 	int i = -1;
 	char *magic = ".KSF";
-	char buf[5];
+	size_t len;
+	char *file;
 
-	if ((fd = open(path, O_RDONLY)) < 0)
+	if (!(file = mmap(path, &len)))
 		return NULL;
 
-	buf[4] = 0;
 	/* check the magic number */
-	if ((read(fd, buf, 4) != 4) || (strcmp(magic, buf) != 0)) {
-		close(fd);
+	if (len < 4 + sizeof(int) || memcmp(magic, file, 4) != 0) {
+		munmap(file);
 		return NULL;
 	}
 
 	/* read the numbers of tones */
-	if (read(fd, &nb, sizeof(int)) != sizeof(int)) {
-		close(fd);
+	memcpy(&nb, file + 4, sizeof(int));
+	if (nb < 0 || (len - 4 - sizeof(int)) / (2 * sizeof(int)) < (size_t)nb) {
+		munmap(file);
 		return NULL;
 	}
 
 	/* allocate space to store the new melody */
 	if (!(melody = malloc((nb + 1) * sizeof(struct melody)))) {
-		close(fd);
+		munmap(file);
 		return NULL;
 	}
 
 	/* load the melody */
+	const int *tones = (const int *)(file + 4 + sizeof(int));
 	for (i = 0; i < nb; i++) {
-		if (read(fd, &melody[i].freq, sizeof(int)) != sizeof(int) ||
-		    read(fd, &melody[i].duration, sizeof(int)) != sizeof(int)) {
-			close(fd);
-			free(melody);
-			return NULL;
-		}
+		melody[i].freq = tones[2 * i];
+		melody[i].duration = tones[2 * i + 1];
 	}
 
 	/* put a null tones to indicate end of melody */
 	melody[nb].freq = 0;
 	melody[nb].duration = (unsigned long)-1;
 
-	close(fd);
+	munmap(file);
 
 	return (melody);
 }
@@ -162,3 +162,32 @@ void set_palette(unsigned int *new_palette, size_t size)
 {
 	syscall2(SYSCALL_SETPALETTE, (u32)new_palette, size);
 }
+
+/* assets bundled in the rom are already in memory, see asset.c */
+void *mmap(const char *pathname, size_t *length)
+{
+	const void *asset = asset_find(pathname, length);
+
+	if (asset)
+		return ((void *)asset);
+
+	return ((void *)syscall2(SYSCALL_MMAP, (u32)pathname, (u32)length));
+}
+
+int munmap(void *addr)
+{
+	if (asset_owns(addr))
+		return (0);
+
+	return ((int)syscall1(SYSCALL_MUNMAP, (u32)addr));
+}
+
+int exec(const char *pathname)
+{
+	return ((int)syscall1(SYSCALL_EXEC, (u32)pathname));
+}
+
+int switchrom(const char *pathname)
+{
+	return ((int)syscall1(SYSCALL_SWITCH, (u32)pathname));
+}
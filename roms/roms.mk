@@ -2,23 +2,77 @@ include ../../config.mk
 
 DEPS = $(OBJS:.o=.d)
 
+MKBUNDLE = ../../tools/mkbundle/mkbundle
 MKKFS	= ../../tools/mkkfs/mkkfs
+MKROMZ	= ../../tools/mkromz/mkromz
+# compressed and deduplicated blocks: fewer sectors to load at boot
+MKKFS_FLAGS ?= -z -d -t
+# set MKKFS_UPDATE while working on assets: the image is then updated in
+# place, only changed files being written again, and keeps the blocks they
+# used to have. Leave it unset to build images to install from scratch.
+MKKFS_UPDATE ?=
 
-all: $(TARGET)
+# the rom is installed compressed, see <k/romz.h>: fewer sectors to read
+# when it is launched. Set ROMZ to nothing to install the plain ELF.
+ROMZ ?= y
+ROM_BIN = $(if $(ROMZ),$(TARGET).z,$(TARGET))
+
+# ROM_FILES linked into .rodata, see <k/bundle.h>: libk maps them straight
+# from memory. Set BUNDLE to nothing to leave them to the file system.
+BUNDLE ?= y
+OBJCOPY ?= objcopy
+BUNDLE_OBJ = $(if $(BUNDLE),$(TARGET).bundle.o)
+# without a bundle, the assets are read from a kfs image under /usr instead:
+# that ramdisk path is the fallback, nothing reads it when BUNDLE is set
+ROM_IMAGE = $(if $(BUNDLE),,$(TARGET).rom)
+
+# linked against the shared libk, loaded once by the kernel and shared with
+# the other roms, see k/dynlink.c. Set SHARED_LIBK to nothing to embed libk
+# and libc. Data of the library is reached through text relocations rather
+# than copies, so that it stays in the library.
+SHARED_LIBK ?= y
+LIBK_SO	= ../../libs/libk/libk.so
+DYN_LDFLAGS = -no-pie -Wl,-z,nocopyreloc -Wl,-z,notext -Wl,--hash-style=sysv \
+	      -Wl,--no-dynamic-linker
+ROM_LDFLAGS = $(if $(SHARED_LIBK),$(filter-out -static,$(LDFLAGS)) $(DYN_LDFLAGS),$(LDFLAGS))
+ROM_LDLIBS = $(if $(SHARED_LIBK),$(LIBK_SO),-L ../../libs/libk -L ../../libs/libc -lk -lc)
+
+all: $(TARGET) $(ROM_IMAGE) $(ROM_BIN)
 
 $(TARGET): CPPFLAGS += -MMD -I ../../k/include -I ../../libs/libc/include -I ../../libs/libk/include -DRES_PATH='"/usr/$(TARGET)/"'
-$(TARGET): LDFLAGS += -Wl,-T../roms.lds
-$(TARGET): LDLIBS = -L ../../libs/libk -L ../../libs/libc -lk -lc
-$(TARGET): $(OBJS)
+$(TARGET): LDFLAGS := $(ROM_LDFLAGS) -Wl,-T../roms.lds
+$(TARGET): LDLIBS = $(ROM_LDLIBS)
+$(TARGET): $(OBJS) $(BUNDLE_OBJ)
+
+$(TARGET).bundle: $(ROM_FILES)
+	$(MKBUNDLE) -p /usr/$(TARGET)/ -o $@ $^
+
+$(TARGET).bundle.o: $(TARGET).bundle
+	$(OBJCOPY) -I binary -O elf32-i386 -B i386 \
+		--rename-section .data=.bundle,alloc,load,readonly,data,contents \
+		--add-section .note.GNU-stack=/dev/null \
+		$< $@
+
+# assets packed as a kfs image, loaded by grub as a multiboot module and
+# served from memory by the kernel ramdisk
+$(TARGET).rom: $(ROM_FILES)
+	$(MKKFS) $(MKKFS_FLAGS) $(if $(MKKFS_UPDATE),-u) -n $(TARGET) -o $@ $^
+
+$(TARGET).z: $(TARGET)
+	$(MKROMZ) -o $@ $<
 
-install: $(TARGET)
-	$(INSTALL) $(TARGET) $(INSTALL_ROOT)/bin/$(TARGET)
+install: $(ROM_BIN) $(ROM_IMAGE)
+	$(INSTALL) $(ROM_BIN) $(INSTALL_ROOT)/bin/$(TARGET)
+ifeq ($(BUNDLE),)
+	$(INSTALL) -m0644 $(TARGET).rom $(INSTALL_ROOT)/usr/$(TARGET).rom
 	for i in $(ROM_FILES); do \
 		$(INSTALL) -m0644 $$i $(INSTALL_ROOT)/usr/$(TARGET)/$$i || exit 1; \
 	done
+endif
 
 clean:
-	$(RM) $(OBJS) $(DEPS) $(TARGET) $(TARGET).rom
+	$(RM) $(OBJS) $(DEPS) $(TARGET) $(TARGET).rom $(TARGET).z \
+		$(TARGET).bundle $(TARGET).bundle.o
 
 -include $(DEPS)
 
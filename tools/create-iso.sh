@@ -23,11 +23,26 @@ get_make_var()
 	make -pn -C $2 | grep "^$1 = " | cut -d' ' -f 3-
 }
 
+# /bin, /lib...: what every rom needs, see BOOT_IMAGES
+boot_modules=$(for i in $base_dir/boot/*.kfs; do
+	[ -f "$i" ] || continue
+	name=$(basename "$i" .kfs)
+	printf '\tmodule /boot/%s.kfs /%s/\n' $name $name
+done)
+
 shift 2
 for i in $@; do
+	target=$(get_make_var TARGET "$i")
+	# bundled roms carry their assets, only the others have an image
+	rom_module=
+	if [ -f $base_dir/usr/$target.rom ]; then
+		rom_module=$(printf '\n\tmodule /usr/%s.rom /usr/%s/res/' \
+			$target $target)
+	fi
 	cat <<EOF
 menuentry "k - $(get_make_var ROM_TITLE "$i")" {
-	multiboot /k /bin/$(get_make_var TARGET "$i")
+	multiboot /k /bin/$target
+$boot_modules$rom_module
 }
 EOF
 done > $base_dir/boot/grub/grub.cfg
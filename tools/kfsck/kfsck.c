@@ -0,0 +1,365 @@
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <unistd.h>
+
+#include "libkfs.h"
+
+static int verbose;
+
+#define pr_info(fmt, ...) \
+	do { \
+		if (verbose) { \
+			printf("[+] " fmt, __VA_ARGS__); \
+		} \
+	} while (0)
+
+struct kfs_check {
+	u32 idx;
+	enum kfs_blk_type type;
+};
+
+struct kfsck {
+	struct kfs_image img;
+	const char *extract_dir;
+	/* blocks to verify, each listed once */
+	struct kfs_check *checks;
+	size_t nb_checks;
+	u8 *listed;
+	/* files, in chain order then the ones only the index knows about */
+	const struct kfs_inode **inodes;
+	size_t nb_inodes;
+	size_t next;
+	unsigned int errors;
+};
+
+static const char *kfs_blk_type_name[] = {
+	[KFS_BLK_SUPER] = "superblock",
+	[KFS_BLK_INODE] = "inode",
+	[KFS_BLK_INDEX] = "index",
+	[KFS_BLK_LZMAP] = "lzmap",
+	[KFS_BLK_DATA] = "data",
+};
+
+#define kfsck_error(ck, fmt, ...) \
+	do { \
+		fprintf(stderr, "kfsck: " fmt "\n", __VA_ARGS__); \
+		__atomic_fetch_add(&(ck)->errors, 1, __ATOMIC_RELAXED); \
+	} while (0)
+
+static void kfsck_list(struct kfsck *ck, u32 idx, enum kfs_blk_type type)
+{
+	if (idx >= ck->img.blk_cnt) {
+		kfsck_error(ck, "%s block %u is out of the image",
+			    kfs_blk_type_name[type], idx);
+		return;
+	}
+
+	if (ck->listed[idx]) {
+		/* deduplicated data blocks are shared, nothing else is */
+		if (type != KFS_BLK_DATA || ck->listed[idx] != type + 1)
+			kfsck_error(ck, "block %u is used as %s and %s", idx,
+				    kfs_blk_type_name[ck->listed[idx] - 1],
+				    kfs_blk_type_name[type]);
+		return;
+	}
+
+	ck->listed[idx] = type + 1;
+	ck->checks[ck->nb_checks++] = (struct kfs_check) { idx, type };
+}
+
+/**
+ * @brief Check the extents of a file and list its blocks.
+ */
+static void kfsck_file(struct kfsck *ck, const struct kfs_inode *ino)
+{
+	u32 blk_cnt = 0;
+
+	if (ino->extent_cnt > KFS_EXTENT_CNT) {
+		kfsck_error(ck, "inode %u has %u extents", ino->idx,
+			    ino->extent_cnt);
+		return;
+	}
+
+	for (u32 i = 0; i < ino->extent_cnt; ++i) {
+		const struct kfs_extent *e = &ino->extents[i];
+
+		for (u32 n = 0; n < e->blk_cnt && e->start + n < ck->img.blk_cnt; ++n)
+			kfsck_list(ck, e->start + n, KFS_BLK_DATA);
+		if (e->start + e->blk_cnt > ck->img.blk_cnt)
+			kfsck_error(ck, "inode %u maps blocks past the image",
+				    ino->idx);
+		blk_cnt += e->blk_cnt;
+	}
+
+	if (blk_cnt != ino->blk_cnt)
+		kfsck_error(ck, "inode %u maps %u blocks out of %u", ino->idx,
+			    blk_cnt, ino->blk_cnt);
+
+	/* a packed tail holds what is left past the blocks of the file */
+	u64 raw_sz = (u64)ino->blk_cnt * KFS_BLK_DATA_SZ + ino->tail_len;
+	if (!(ino->flags & KFS_INODE_LZ) &&
+	    (ino->tail_len ? raw_sz != ino->file_sz :
+	     ino->blk_cnt != (ino->file_sz + KFS_BLK_DATA_SZ - 1) / KFS_BLK_DATA_SZ))
+		kfsck_error(ck, "inode %u has %u blocks for %u bytes",
+			    ino->idx, ino->blk_cnt, ino->file_sz);
+
+	if (ino->tail_len) {
+		kfsck_list(ck, ino->tail_blk, KFS_BLK_DATA);
+		if (ino->tail_len >= KFS_BLK_DATA_SZ ||
+		    ((ino->flags & KFS_INODE_LZ) && ino->blk_cnt))
+			kfsck_error(ck, "inode %u has a bad tail of %u bytes",
+				    ino->idx, ino->tail_len);
+	}
+
+	if (ino->lz_map) {
+		kfsck_list(ck, ino->lz_map, KFS_BLK_LZMAP);
+		if (kfs_block_valid(&ck->img, ino->lz_map, KFS_BLK_LZMAP) &&
+		    kfs_block(&ck->img, ino->lz_map)->lzmap.blk_cnt != ino->blk_cnt)
+			kfsck_error(ck, "inode %u and its lzmap disagree",
+				    ino->idx);
+	}
+}
+
+/**
+ * @brief Walk the inode chain and the filename index.
+ */
+static void kfsck_walk(struct kfsck *ck)
+{
+	const struct kfs_superblock *sb = ck->img.sb;
+	const struct kfs_inode *ino = NULL;
+	u32 unchained = 0;
+
+	kfsck_list(ck, 0, KFS_BLK_SUPER);
+
+	for (u32 i = 0; i < sb->inode_cnt; ++i) {
+		u32 idx = ino ? ino->next_inode : sb->inode_idx;
+
+		kfsck_list(ck, idx, KFS_BLK_INODE);
+		ino = kfs_inode(&ck->img, idx);
+		if (!ino) {
+			kfsck_error(ck, "inode %u of the chain is corrupted", idx);
+			break;
+		}
+
+		ck->inodes[ck->nb_inodes++] = ino;
+		kfsck_file(ck, ino);
+	}
+
+	if (ino && ino->next_inode)
+		kfsck_error(ck, "inode chain is longer than %u", sb->inode_cnt);
+
+	for (u32 i = 0; sb->index_idx && i < sb->index_blk_cnt; ++i) {
+		u32 idx = sb->index_idx + i;
+
+		kfsck_list(ck, idx, KFS_BLK_INDEX);
+		if (!kfs_block_valid(&ck->img, idx, KFS_BLK_INDEX))
+			continue;
+
+		/* inodes cut off the chain can still be reached from here */
+		const struct kfs_index *index = &kfs_block(&ck->img, idx)->index;
+		for (u32 j = 0; j < KFS_INDEX_SLOTS; ++j) {
+			u32 ino_idx = index->entries[j].inode_idx;
+
+			if (!ino_idx || ino_idx >= ck->img.blk_cnt ||
+			    ck->listed[ino_idx])
+				continue;
+
+			unchained++;
+			kfsck_list(ck, ino_idx, KFS_BLK_INODE);
+			ino = kfs_inode(&ck->img, ino_idx);
+			if (ino) {
+				ck->inodes[ck->nb_inodes++] = ino;
+				kfsck_file(ck, ino);
+			}
+		}
+	}
+
+	if (unchained)
+		kfsck_error(ck, "%u inodes are only reachable from the index",
+			    unchained);
+
+	/* every file must be found under its own name */
+	for (size_t i = 0; i < ck->nb_inodes; ++i) {
+		char name[KFS_FNAME_SZ + 1] = { 0 };
+		const struct kfs_inode *found;
+
+		memcpy(name, ck->inodes[i]->filename, KFS_FNAME_SZ);
+		found = kfs_lookup(&ck->img, name);
+		if (!found || strncmp(found->filename, name, KFS_FNAME_SZ))
+			kfsck_error(ck, "\"%s\" cannot be looked up", name);
+	}
+}
+
+static void *kfsck_verify_run(void *arg)
+{
+	struct kfsck *ck = arg;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&ck->next, 1, __ATOMIC_RELAXED)) < ck->nb_checks) {
+		const struct kfs_check *c = &ck->checks[i];
+
+		if (!kfs_block_valid(&ck->img, c->idx, c->type))
+			kfsck_error(ck, "%s block %u is corrupted",
+				    kfs_blk_type_name[c->type], c->idx);
+	}
+
+	return NULL;
+}
+
+static void kfsck_extract(struct kfsck *ck, const struct kfs_inode *ino,
+			  const char *name, const void *data)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	if (strchr(name, '/') || !strcmp(name, ".") || !strcmp(name, "..")) {
+		kfsck_error(ck, "\"%s\" is not a valid file name", name);
+		return;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", ck->extract_dir, name);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		err(1, "unable to open %s", path);
+
+	for (size_t pos = 0; pos < ino->file_sz;) {
+		ssize_t rc = write(fd, (const u8 *)data + pos, ino->file_sz - pos);
+
+		if (rc < 0)
+			err(1, "unable to write %s", path);
+		pos += rc;
+	}
+
+	close(fd);
+}
+
+static void *kfsck_read_run(void *arg)
+{
+	struct kfsck *ck = arg;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&ck->next, 1, __ATOMIC_RELAXED)) < ck->nb_inodes) {
+		const struct kfs_inode *ino = ck->inodes[i];
+		char name[KFS_FNAME_SZ + 1] = { 0 };
+		void *data = malloc(ino->file_sz ? ino->file_sz : 1);
+		ssize_t rc;
+
+		if (!data)
+			err(1, "unable to allocate %u bytes", ino->file_sz);
+
+		memcpy(name, ino->filename, KFS_FNAME_SZ);
+		rc = kfs_read(&ck->img, ino, data, ino->file_sz, 0);
+		if (rc != (ssize_t)ino->file_sz) {
+			kfsck_error(ck, "\"%s\" cannot be read", name);
+		} else {
+			pr_info("%s: %u bytes in %u blocks%s\n", name,
+				ino->file_sz, ino->blk_cnt,
+				ino->flags & KFS_INODE_LZ ? ", compressed" : "");
+			if (ck->extract_dir)
+				kfsck_extract(ck, ino, name, data);
+		}
+
+		free(data);
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Run fn with nb_threads threads, ck->next being the shared cursor.
+ */
+static void kfsck_run(void *(*fn)(void *), struct kfsck *ck, size_t nb_threads)
+{
+	pthread_t threads[nb_threads];
+
+	ck->next = 0;
+	for (size_t i = 1; i < nb_threads; ++i) {
+		int rc = pthread_create(&threads[i], NULL, fn, ck);
+
+		if (rc)
+			errx(1, "unable to create thread: %s", strerror(rc));
+	}
+
+	fn(ck);
+
+	for (size_t i = 1; i < nb_threads; ++i)
+		pthread_join(threads[i], NULL);
+}
+
+static inline void usage(void)
+{
+	extern const char *__progname;
+
+	fprintf(stderr, "usage: %s [-v] [-j jobs] [-x dir] rom_file\n",
+		__progname);
+
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct kfsck ck = { 0 };
+	long nb_threads = 1;
+	int opt;
+	int rc;
+
+	while ((opt = getopt(argc, argv, "j:vx:")) != -1) {
+		switch (opt) {
+		case 'j':
+			nb_threads = strtol(optarg, NULL, 10);
+			if (nb_threads < 1 || nb_threads > 256)
+				usage();
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'x':
+			ck.extract_dir = optarg;
+			break;
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (optind != argc - 1)
+		usage();
+
+	rc = kfs_open(&ck.img, argv[optind]);
+	if (rc)
+		errx(1, "%s: %s", argv[optind],
+		     rc == -EINVAL ? "not a kfs image of a supported version" :
+				     strerror(-rc));
+
+	ck.checks = calloc(ck.img.blk_cnt, sizeof(*ck.checks));
+	ck.listed = calloc(ck.img.blk_cnt, sizeof(*ck.listed));
+	ck.inodes = calloc(ck.img.blk_cnt, sizeof(*ck.inodes));
+	if (!ck.checks || !ck.listed || !ck.inodes)
+		err(1, "unable to allocate memory");
+
+	if (ck.img.sb->blk_cnt * (size_t)KFS_BLK_SZ > ck.img.size)
+		kfsck_error(&ck, "image is truncated to %zu blocks",
+			    ck.img.size / KFS_BLK_SZ);
+
+	kfsck_walk(&ck);
+	kfsck_run(kfsck_verify_run, &ck, nb_threads);
+	kfsck_run(kfsck_read_run, &ck, nb_threads);
+
+	printf("%s: %u blocks, %zu files, %zu blocks verified, %u errors\n",
+	       argv[optind], ck.img.blk_cnt, ck.nb_inodes, ck.nb_checks,
+	       ck.errors);
+
+	free(ck.inodes);
+	free(ck.listed);
+	free(ck.checks);
+	kfs_close(&ck.img);
+
+	return ck.errors ? 1 : 0;
+}
@@ -0,0 +1,286 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <k/lz.h>
+
+#include "libkfs.h"
+
+int kfs_open(struct kfs_image *img, const char *path)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+	int rc = 0;
+
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) < 0) {
+		rc = -errno;
+		goto out;
+	}
+
+	if ((size_t)st.st_size < KFS_BLK_SZ) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	img->size = st.st_size;
+	img->blks = mmap(NULL, img->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (img->blks == MAP_FAILED) {
+		rc = -errno;
+		goto out;
+	}
+
+	img->sb = (const struct kfs_superblock *)&img->blks[0];
+	img->blk_cnt = MIN(img->sb->blk_cnt, img->size / KFS_BLK_SZ);
+
+	if (img->sb->magic != KFS_MAGIC || img->sb->version != KFS_VERSION ||
+	    !kfs_block_valid(img, 0, KFS_BLK_SUPER)) {
+		munmap((void *)img->blks, img->size);
+		rc = -EINVAL;
+	}
+
+out:
+	close(fd);
+	return rc;
+}
+
+void kfs_close(struct kfs_image *img)
+{
+	munmap((void *)img->blks, img->size);
+	img->blks = NULL;
+}
+
+const struct kfs_blk *kfs_block(const struct kfs_image *img, u32 idx)
+{
+	return idx < img->blk_cnt ? &img->blks[idx] : NULL;
+}
+
+int kfs_block_valid(const struct kfs_image *img, u32 idx,
+		    enum kfs_blk_type type)
+{
+	const struct kfs_blk *b = kfs_block(img, idx);
+
+	if (!b)
+		return 0;
+
+	switch (type) {
+	case KFS_BLK_SUPER:
+		return kfs_checksum(img->sb, sizeof(*img->sb) - sizeof(img->sb->cksum)) ==
+		       img->sb->cksum;
+	case KFS_BLK_INODE:
+		return b->ino.idx == idx &&
+		       kfs_checksum(&b->ino, sizeof(b->ino) - sizeof(b->ino.cksum)) ==
+		       b->ino.cksum;
+	case KFS_BLK_INDEX:
+		return b->index.idx == idx &&
+		       kfs_checksum(&b->index, sizeof(b->index) - sizeof(b->index.cksum)) ==
+		       b->index.cksum;
+	case KFS_BLK_LZMAP:
+		return b->lzmap.idx == idx &&
+		       kfs_checksum(&b->lzmap, sizeof(b->lzmap) - sizeof(b->lzmap.cksum)) ==
+		       b->lzmap.cksum;
+	case KFS_BLK_DATA:
+		return b->blk.idx == idx &&
+		       kfs_block_checksum(&b->blk) == b->blk.cksum;
+	}
+
+	return 0;
+}
+
+const struct kfs_inode *kfs_inode(const struct kfs_image *img, u32 idx)
+{
+	if (!idx || !kfs_block_valid(img, idx, KFS_BLK_INODE))
+		return NULL;
+
+	return &img->blks[idx].ino;
+}
+
+const struct kfs_inode *kfs_inode_next(const struct kfs_image *img,
+				       const struct kfs_inode *prev)
+{
+	return kfs_inode(img, prev ? prev->next_inode : img->sb->inode_idx);
+}
+
+static const struct kfs_inode *
+kfs_index_lookup(const struct kfs_image *img, const char *name)
+{
+	u32 hash = kfs_name_hash(name);
+	u32 blk_cnt = img->sb->index_blk_cnt;
+	u32 idx = img->sb->index_idx + hash % blk_cnt;
+
+	if (!kfs_block_valid(img, idx, KFS_BLK_INDEX))
+		return NULL;
+
+	const struct kfs_index *index = &img->blks[idx].index;
+	u32 slot = hash / blk_cnt % KFS_INDEX_SLOTS;
+
+	for (u32 i = 0; i < KFS_INDEX_SLOTS; ++i) {
+		const struct kfs_index_entry *e = &index->entries[slot];
+
+		if (!e->inode_idx)
+			break;
+
+		if (e->hash == hash) {
+			const struct kfs_inode *ino = kfs_inode(img, e->inode_idx);
+
+			if (ino && !strncmp(ino->filename, name, KFS_FNAME_SZ))
+				return ino;
+		}
+
+		slot = (slot + 1) % KFS_INDEX_SLOTS;
+	}
+
+	return NULL;
+}
+
+const struct kfs_inode *kfs_lookup(const struct kfs_image *img,
+				   const char *name)
+{
+	const struct kfs_inode *ino = NULL;
+
+	if (img->sb->index_idx && img->sb->index_blk_cnt)
+		return kfs_index_lookup(img, name);
+
+	for (u32 i = 0; i < img->sb->inode_cnt; ++i) {
+		ino = kfs_inode_next(img, ino);
+		if (!ino)
+			break;
+		if (!strncmp(ino->filename, name, KFS_FNAME_SZ))
+			return ino;
+	}
+
+	return NULL;
+}
+
+/* packed tail of a file, within its shared block */
+static const u8 *kfs_tail_data(const struct kfs_image *img,
+			       const struct kfs_inode *ino, size_t *len)
+{
+	const struct kfs_blk *b = kfs_block(img, ino->tail_blk);
+
+	if (!b || b->blk.usage > KFS_BLK_DATA_SZ ||
+	    ino->tail_off > b->blk.usage ||
+	    ino->tail_len > b->blk.usage - ino->tail_off)
+		return NULL;
+
+	*len = ino->tail_len;
+	return b->blk.data + ino->tail_off;
+}
+
+const void *kfs_block_data(const struct kfs_image *img,
+			   const struct kfs_inode *ino, u32 n, size_t *len)
+{
+	if (n == ino->blk_cnt && ino->tail_len)
+		return kfs_tail_data(img, ino, len);
+
+	/* past the extents: kfs_block(img, 0) would be the superblock */
+	u32 idx = kfs_bmap(ino, n);
+	const struct kfs_blk *b = idx ? kfs_block(img, idx) : NULL;
+
+	if (!b || (ino->flags & KFS_INODE_LZ) || b->blk.usage > KFS_BLK_DATA_SZ)
+		return NULL;
+
+	*len = b->blk.usage;
+	return b->blk.data;
+}
+
+static ssize_t kfs_read_plain(const struct kfs_image *img,
+			      const struct kfs_inode *ino, void *buf,
+			      size_t count, off_t off)
+{
+	size_t done = 0;
+
+	while (done < count) {
+		size_t pos = off + done;
+		size_t blk_off = pos % KFS_BLK_DATA_SZ;
+		size_t len;
+		const u8 *data = kfs_block_data(img, ino, pos / KFS_BLK_DATA_SZ,
+						&len);
+
+		if (!data || len <= blk_off)
+			return -EIO;
+
+		len = MIN(len - blk_off, count - done);
+		memcpy((u8 *)buf + done, data + blk_off, len);
+		done += len;
+	}
+
+	return done;
+}
+
+static ssize_t kfs_read_lz(const struct kfs_image *img,
+			   const struct kfs_inode *ino, void *buf,
+			   size_t count, off_t off)
+{
+	const struct kfs_lzmap *map = NULL;
+	u8 tmp[KFS_LZ_RAW_MAX];
+	size_t done = 0;
+
+	if (ino->lz_map) {
+		if (!kfs_block_valid(img, ino->lz_map, KFS_BLK_LZMAP))
+			return -EIO;
+		map = &img->blks[ino->lz_map].lzmap;
+	}
+
+	while (done < count) {
+		size_t pos = off + done;
+		size_t start;
+		size_t end;
+		u32 n;
+
+		if (kfs_lz_find(map, ino, pos, &n, &start, &end))
+			return -EIO;
+
+		u32 idx = kfs_bmap(ino, n);
+		const struct kfs_blk *b = idx ? kfs_block(img, idx) : NULL;
+		const u8 *src = b ? b->blk.data : NULL;
+		size_t sz = b ? b->blk.usage & ~KFS_BLK_LZ : 0;
+
+		/* a compressed file with no block is a packed tail */
+		if (!ino->blk_cnt)
+			src = kfs_tail_data(img, ino, &sz);
+		else if (!b || !(b->blk.usage & KFS_BLK_LZ) ||
+			 sz > KFS_BLK_DATA_SZ)
+			src = NULL;
+
+		if (!src)
+			return -EIO;
+
+		/* whole block wanted: decompress straight into buf */
+		u8 *dst = start == pos && end - pos <= count - done ?
+			  (u8 *)buf + done : tmp;
+
+		if (lz_decompress(src, sz, dst, end - start) !=
+		    (int)(end - start))
+			return -EIO;
+
+		size_t len = MIN(end - pos, count - done);
+		if (dst == tmp)
+			memcpy((u8 *)buf + done, tmp + (pos - start), len);
+		done += len;
+	}
+
+	return done;
+}
+
+ssize_t kfs_read(const struct kfs_image *img, const struct kfs_inode *ino,
+		 void *buf, size_t count, off_t off)
+{
+	if (off < 0)
+		return -EINVAL;
+	if ((size_t)off >= ino->file_sz)
+		return 0;
+	count = MIN(count, ino->file_sz - off);
+
+	if (ino->flags & KFS_INODE_LZ)
+		return kfs_read_lz(img, ino, buf, count, off);
+
+	return kfs_read_plain(img, ino, buf, count, off);
+}
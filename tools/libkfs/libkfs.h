@@ -0,0 +1,78 @@
+#ifndef LIBKFS_H
+#define LIBKFS_H
+
+#include <sys/types.h>
+
+#include <k/kfs.h>
+
+/*
+ * Host side KFS reader. The image is mapped read-only and every structure
+ * is handed out as a pointer into the mapping, nothing is copied but the
+ * decompressed data of compressed files.
+ */
+struct kfs_image {
+	const struct kfs_blk *blks;
+	const struct kfs_superblock *sb;
+	size_t size;
+	u32 blk_cnt;
+};
+
+enum kfs_blk_type {
+	KFS_BLK_SUPER,
+	KFS_BLK_INODE,
+	KFS_BLK_INDEX,
+	KFS_BLK_LZMAP,
+	KFS_BLK_DATA,
+};
+
+/**
+ * @brief Map an image and check its superblock.
+ * @return 0, or a negative errno value.
+ */
+int kfs_open(struct kfs_image *img, const char *path);
+
+void kfs_close(struct kfs_image *img);
+
+/**
+ * @brief Block idx of the image, NULL if it lies outside of it.
+ */
+const struct kfs_blk *kfs_block(const struct kfs_image *img, u32 idx);
+
+/**
+ * @brief Check the checksum of a block, and that it knows its own index.
+ */
+int kfs_block_valid(const struct kfs_image *img, u32 idx,
+		    enum kfs_blk_type type);
+
+/**
+ * @brief Inode stored in block idx, NULL if not a valid inode.
+ */
+const struct kfs_inode *kfs_inode(const struct kfs_image *img, u32 idx);
+
+/**
+ * @brief Next inode of the chain, the first one if prev is NULL.
+ */
+const struct kfs_inode *kfs_inode_next(const struct kfs_image *img,
+				       const struct kfs_inode *prev);
+
+/**
+ * @brief Find a file by name, through the filename index if there is one.
+ */
+const struct kfs_inode *kfs_lookup(const struct kfs_image *img,
+				   const char *name);
+
+/**
+ * @brief Data of the n-th block of an uncompressed file, in place. The
+ *        block past the last one is the packed tail of the file, if any.
+ */
+const void *kfs_block_data(const struct kfs_image *img,
+			   const struct kfs_inode *ino, u32 n, size_t *len);
+
+/**
+ * @brief Read from a file, decompressing it if needed.
+ * @return the number of bytes read, or a negative errno value.
+ */
+ssize_t kfs_read(const struct kfs_image *img, const struct kfs_inode *ino,
+		 void *buf, size_t count, off_t off);
+
+#endif
@@ -0,0 +1,198 @@
+#include <err.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <k/bundle.h>
+
+#define align_up(v, d)	((((v) + (d) - 1) / (d)) * (d))
+
+struct bundle_file {
+	const char *path;
+	char *name;
+	size_t size;
+};
+
+/**
+ * @brief Bundle name of a file: prefix and path with runs of '/' squeezed,
+ *        as asset_find() compares them.
+ */
+static char *bundle_name(const char *prefix, const char *path)
+{
+	size_t len = strlen(prefix) + strlen(path);
+	char *name = malloc(len + 1);
+	char *p = name;
+
+	if (!name)
+		err(1, "unable to allocate %zu bytes", len + 1);
+
+	for (const char *s = prefix; *s; ++s) {
+		if (*s != '/' || p == name || p[-1] != '/')
+			*p++ = *s;
+	}
+	for (const char *s = path; *s; ++s) {
+		if (*s != '/' || p == name || p[-1] != '/')
+			*p++ = *s;
+	}
+	*p = '\0';
+
+	return name;
+}
+
+static int bundle_cmp(const void *a, const void *b)
+{
+	const struct bundle_file *fa = a;
+	const struct bundle_file *fb = b;
+
+	return strcmp(fa->name, fb->name);
+}
+
+static void bundle_copy(FILE *out, const char *path, size_t size)
+{
+	char buf[65536];
+	FILE *in = fopen(path, "rb");
+
+	if (!in)
+		err(1, "unable to open %s", path);
+
+	while (size) {
+		size_t n = fread(buf, 1, size < sizeof(buf) ? size : sizeof(buf),
+				 in);
+		if (!n)
+			errx(1, "%s: short read", path);
+		if (fwrite(buf, 1, n, out) != n)
+			err(1, "unable to write bundle");
+		size -= n;
+	}
+
+	fclose(in);
+}
+
+static void bundle_pad(FILE *out, size_t len)
+{
+	static const char zeroes[BUNDLE_ALIGN];
+
+	if (fwrite(zeroes, 1, len, out) != len)
+		err(1, "unable to write bundle");
+}
+
+static inline void usage(void)
+{
+	extern const char *__progname;
+
+	fprintf(stderr, "usage: %s [-p prefix] -o bundle_file files...\n",
+		__progname);
+
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	char *bundle_file = NULL;
+	char *prefix = "";
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:p:")) != -1) {
+		switch (opt) {
+		case 'o':
+			bundle_file = optarg;
+			break;
+		case 'p':
+			prefix = optarg;
+			break;
+		default:
+			usage();
+			break;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (!bundle_file)
+		usage();
+
+	size_t nb_files = argc;
+	struct bundle_file *files = calloc(nb_files + 1, sizeof(*files));
+	if (!files)
+		err(1, "unable to allocate %zu files", nb_files);
+
+	for (size_t i = 0; i < nb_files; ++i) {
+		struct stat st;
+
+		if (stat(argv[i], &st) < 0)
+			err(1, "unable to stat %s", argv[i]);
+
+		files[i].path = argv[i];
+		files[i].name = bundle_name(prefix, argv[i]);
+		files[i].size = st.st_size;
+	}
+
+	/* asset_find() does a binary search */
+	qsort(files, nb_files, sizeof(*files), bundle_cmp);
+	for (size_t i = 1; i < nb_files; ++i) {
+		if (!strcmp(files[i - 1].name, files[i].name))
+			errx(1, "%s: bundled twice", files[i].name);
+	}
+
+	struct bundle_header hdr = {
+		.magic = BUNDLE_MAGIC,
+		.cnt = nb_files,
+	};
+	struct bundle_entry *entries = calloc(nb_files + 1, sizeof(*entries));
+	if (!entries)
+		err(1, "unable to allocate %zu entries", nb_files);
+
+	size_t off = sizeof(hdr) + nb_files * sizeof(*entries);
+	for (size_t i = 0; i < nb_files; ++i) {
+		entries[i].name = off;
+		off += strlen(files[i].name) + 1;
+	}
+	off = align_up(off, BUNDLE_ALIGN);
+	size_t data_off = off;
+	for (size_t i = 0; i < nb_files; ++i) {
+		entries[i].offset = off;
+		entries[i].size = files[i].size;
+		off = align_up(off + files[i].size, BUNDLE_ALIGN);
+	}
+	if (off > UINT32_MAX)
+		errx(1, "bundle too large: %zu bytes", off);
+
+	FILE *out = fopen(bundle_file, "wb");
+	if (!out)
+		err(1, "unable to open %s", bundle_file);
+
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+	    fwrite(entries, sizeof(*entries), nb_files, out) != nb_files)
+		err(1, "unable to write %s", bundle_file);
+
+	size_t pos = sizeof(hdr) + nb_files * sizeof(*entries);
+	for (size_t i = 0; i < nb_files; ++i) {
+		size_t len = strlen(files[i].name) + 1;
+
+		if (fwrite(files[i].name, 1, len, out) != len)
+			err(1, "unable to write %s", bundle_file);
+		pos += len;
+	}
+	bundle_pad(out, data_off - pos);
+
+	for (size_t i = 0; i < nb_files; ++i) {
+		bundle_copy(out, files[i].path, files[i].size);
+		bundle_pad(out, align_up(files[i].size, BUNDLE_ALIGN) -
+				files[i].size);
+	}
+
+	if (fclose(out))
+		err(1, "unable to write %s", bundle_file);
+
+	for (size_t i = 0; i < nb_files; ++i)
+		free(files[i].name);
+	free(entries);
+	free(files);
+
+	return 0;
+}
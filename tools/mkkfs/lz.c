@@ -0,0 +1,108 @@
+#include <string.h>
+#include <sys/param.h>
+
+#include <k/lz.h>
+
+#include "lz.h"
+
+#define LZ_HASH_LOG 12
+
+static u32 lz_read32(const u8 *p)
+{
+	u32 v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static u32 lz_hash(u32 v)
+{
+	return (v * 2654435761u) >> (32 - LZ_HASH_LOG);
+}
+
+/**
+ * @brief Number of extra bytes needed to encode a length in a token nibble.
+ */
+static size_t lz_len_size(size_t len)
+{
+	return len < 15 ? 0 : (len - 15) / 255 + 1;
+}
+
+static u8 *lz_write_len(u8 *op, size_t len)
+{
+	for (len -= 15; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+
+	return op;
+}
+
+static u8 *lz_write_literals(u8 *op, const u8 *lit, size_t len, size_t mlen)
+{
+	*op++ = MIN(len, 15) << 4 | MIN(mlen, 15);
+	if (len >= 15)
+		op = lz_write_len(op, len);
+	memcpy(op, lit, len);
+
+	return op + len;
+}
+
+/*
+ * Greedy single probe matcher: each 4 byte sequence is hashed and only the
+ * last position with the same hash is tried. That is enough for the large
+ * uniform areas of rom resources and keeps mkkfs fast.
+ */
+size_t lz_compress(const void *src, size_t *src_sz, void *dst, size_t dst_sz)
+{
+	const u8 *in = src;
+	u8 *out = dst;
+	u8 *op = out;
+	u8 *oend = out + dst_sz;
+	size_t n = *src_sz;
+	size_t ip = 0;
+	size_t anchor = 0;
+	u32 table[1 << LZ_HASH_LOG] = { 0 }; /* position + 1, 0 if none */
+
+	while (ip + LZ_MIN_MATCH <= n) {
+		u32 h = lz_hash(lz_read32(in + ip));
+		size_t ref = table[h];
+
+		table[h] = ip + 1;
+		if (!ref-- || ip - ref > LZ_MAX_OFFSET ||
+		    lz_read32(in + ref) != lz_read32(in + ip)) {
+			ip++;
+			continue;
+		}
+
+		size_t mlen = LZ_MIN_MATCH;
+		while (ip + mlen < n && in[ref + mlen] == in[ip + mlen])
+			mlen++;
+
+		size_t lit = ip - anchor;
+		size_t cost = 1 + lz_len_size(lit) + lit + 2 +
+			      lz_len_size(mlen - LZ_MIN_MATCH);
+		if (cost > (size_t)(oend - op))
+			break;
+
+		op = lz_write_literals(op, in + anchor, lit, mlen - LZ_MIN_MATCH);
+		*op++ = (ip - ref) & 0xff;
+		*op++ = (ip - ref) >> 8;
+		if (mlen - LZ_MIN_MATCH >= 15)
+			op = lz_write_len(op, mlen - LZ_MIN_MATCH);
+
+		ip += mlen;
+		anchor = ip;
+	}
+
+	/* the rest goes as literals, as many as there is room for */
+	size_t avail = oend - op;
+	size_t lit = avail ? MIN(n - anchor, avail - 1) : 0;
+
+	while (lit && 1 + lz_len_size(lit) + lit > avail)
+		lit--;
+	if (lit)
+		op = lz_write_literals(op, in + anchor, lit, 0);
+
+	*src_sz = anchor + lit;
+	return op - out;
+}
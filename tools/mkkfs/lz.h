@@ -0,0 +1,14 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+/**
+ * @brief Compress as much of the *src_sz bytes of src as fits in dst_sz
+ *        bytes, in the format read by lz_decompress() from <k/lz.h>.
+ *        *src_sz is updated with the number of bytes consumed.
+ * @return the compressed size.
+ */
+size_t lz_compress(const void *src, size_t *src_sz, void *dst, size_t dst_sz);
+
+#endif
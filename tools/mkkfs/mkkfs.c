@@ -23,22 +23,33 @@
  */
 #include <err.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
 #include <k/kfs.h>
 
+#include "libkfs.h"
+#include "lz.h"
+
 #define align_up(v, d)	((((v) + (d) - 1) / (d)) * (d))
 
-#define KFS_MAX_FILE_SZ ((KFS_DIRECT_BLK + KFS_INDIRECT_BLK * \
-			  KFS_INDIRECT_BLK_CNT) * KFS_BLK_DATA_SZ)
+#define KFS_MAX_FILE_SZ UINT32_MAX
 
 static int verbose;
+static int compress;
+static int dedup;
+static int tail;
+static int update;
 
 #define pr_info(fmt, ...) \
 	do { \
@@ -47,178 +58,841 @@ static int verbose;
 		} \
 	} while (0)
 
-static ssize_t kfs_write(int fd, const void *buf, size_t len, off_t off)
+/**
+ * @brief Copy a string into a fixed size field, zero padded and only NUL
+ *        terminated if it is shorter than the field.
+ */
+static void kfs_copy_name(char *field, const char *name, size_t size)
 {
-	ssize_t rc = pwrite(fd, buf, len, off * KFS_BLK_SZ);
+	size_t len = strnlen(name, size);
 
-	if (rc < 0)
-		err(1, "pwrite call failed");
-
-	return rc;
+	memcpy(field, name, len);
+	memset(field + len, 0, size - len);
 }
 
 /**
  * @brief Write superblock to rom.
  */
 static void
-kfs_write_superblock(int romfd, const char *fsname, u32 blk_cnt, u32 files_cnt)
+kfs_write_superblock(struct kfs_blk *image, const char *fsname, u32 blk_cnt,
+		     u32 inode_idx, u32 files_cnt, u32 index_idx,
+		     u32 index_blk_cnt)
 {
-	struct kfs_superblock sblock = {
+	struct kfs_superblock *sblock = (struct kfs_superblock *)image;
+
+	*sblock = (struct kfs_superblock) {
 		.magic = KFS_MAGIC,
+		.version = KFS_VERSION,
 #ifdef DEBUG
 		.ctime = 0,
 #else
 		.ctime = time(NULL),
 #endif
 		.blk_cnt = blk_cnt,
-		.inode_idx = 1,
+		.inode_idx = inode_idx,
 		.inode_cnt = files_cnt,
+		.index_idx = index_idx,
+		.index_blk_cnt = index_blk_cnt,
 		.cksum = 0
 	};
 
-	strncpy(sblock.name, fsname, KFS_NAME_SZ);
-	sblock.cksum = kfs_checksum(&sblock,
-				    sizeof(sblock) - sizeof(sblock.cksum));
+	kfs_copy_name(sblock->name, fsname, sizeof(sblock->name));
+	sblock->cksum = kfs_checksum(sblock,
+				     sizeof(*sblock) - sizeof(sblock->cksum));
+}
+
+/*
+ * Everything about a file is known before any of it is written: its inode
+ * index, the first block index of its data and the number of blocks it
+ * spans. Files can thus be written in any order, by any thread.
+ */
+struct kfs_job {
+	const char *path;
+	struct kfs_inode *inode;
+	u32 inode_idx;
+	int keep;	/* unchanged since the image being updated was built */
+	s32 mtime;
+	u32 file_sz;
+	u32 blk_cnt;
+	u32 blk_idx;	/* first block written for this file */
+	u32 new_cnt;	/* blocks not shared with an earlier file */
+	/* data blocks built in memory, ready but for their index and checksum */
+	struct kfs_block *blks;
+	u32 *blk_map;	/* block index of each data block when deduplicated */
+	int lz;
+	u32 lz_raw_off[KFS_LZMAP_CNT];
+	u32 lz_map;
+	/* end of the file, packed with others in a shared data block */
+	const u8 *tail;
+	u32 tail_len;
+	u32 tail_blk;
+	u32 tail_off;
+};
 
-	kfs_write(romfd, &sblock, sizeof(sblock), 0);
+/**
+ * @brief Block index of the n-th data block of a file.
+ */
+static u32 kfs_job_blk(const struct kfs_job *job, u32 n)
+{
+	return job->blk_map ? job->blk_map[n] : job->blk_idx + n;
 }
 
 /**
- * @brief read next block from file.
- *    fill kfs_block structure.
- * @return filled kfs_block or NULL if EOF reached.
+ * @brief Get the size of every file.
  */
-static ssize_t kfs_read_block(int fd, struct kfs_block *blk)
+static void kfs_stat_files(struct kfs_job *jobs, char **files, size_t nb_files)
 {
-	ssize_t rc = read(fd, blk->data, sizeof(blk->data));
-	if (rc < 0)
-		err(1, "read error");
+	for (size_t i = 0; i < nb_files; ++i) {
+		struct kfs_job *job = &jobs[i];
+		struct stat st;
 
-	if (rc == 0)
-		return 0;
+		if (stat(files[i], &st) < 0)
+			err(1, "unable to stat \"%s\"", files[i]);
 
-	blk->usage = rc;
+		if (st.st_size > KFS_MAX_FILE_SZ)
+			errx(1, "file \"%s\" of size %zu is too large to fit in kfs", files[i], st.st_size);
 
-	return rc;
+		job->path = files[i];
+		job->mtime = st.st_mtime;
+		job->file_sz = st.st_size;
+		job->blk_cnt = align_up(st.st_size, KFS_BLK_DATA_SZ) / KFS_BLK_DATA_SZ;
+	}
+}
+
+/*
+ * Deduplication: data blocks are hashed into a chained table, newest entry
+ * first in each bucket, so that the entries of the file being laid out can
+ * be dropped again if it ends up with too many extents.
+ */
+struct kfs_dedup_entry {
+	struct kfs_dedup_entry *next;
+	const struct kfs_block *blk;
+	u64 hash;
+	u32 idx;
+};
+
+struct kfs_dedup {
+	struct kfs_dedup_entry **buckets;
+	struct kfs_dedup_entry *entries;
+	size_t mask;
+	size_t used;
+};
+
+static u64 kfs_blk_hash(const struct kfs_block *blk)
+{
+	const u8 *p = (const u8 *)&blk->usage;
+	u64 hash = 14695981039346656037ull;
+
+	for (size_t i = 0; i < sizeof(*blk) - offsetof(struct kfs_block, usage); ++i) {
+		hash ^= p[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+static void kfs_dedup_init(struct kfs_dedup *d, size_t nb_blks)
+{
+	size_t size = 1;
+
+	while (size < 2 * nb_blks)
+		size <<= 1;
+
+	d->buckets = calloc(size, sizeof(*d->buckets));
+	d->entries = calloc(nb_blks ? nb_blks : 1, sizeof(*d->entries));
+	if (!d->buckets || !d->entries)
+		err(1, "unable to allocate the deduplication table");
+
+	d->mask = size - 1;
+	d->used = 0;
+}
+
+static const struct kfs_dedup_entry *
+kfs_dedup_find(const struct kfs_dedup *d, const struct kfs_block *blk, u64 hash)
+{
+	for (struct kfs_dedup_entry *e = d->buckets[hash & d->mask]; e; e = e->next)
+		if (e->hash == hash && e->blk->usage == blk->usage &&
+		    !memcmp(e->blk->data, blk->data, sizeof(blk->data)))
+			return e;
+
+	return NULL;
+}
+
+static void kfs_dedup_add(struct kfs_dedup *d, const struct kfs_block *blk,
+			  u64 hash, u32 idx)
+{
+	struct kfs_dedup_entry *e = &d->entries[d->used++];
+
+	e->blk = blk;
+	e->hash = hash;
+	e->idx = idx;
+	e->next = d->buckets[hash & d->mask];
+	d->buckets[hash & d->mask] = e;
 }
 
 /**
- * @brief Write file inode & blocks to rom.
- * @return the next available block index;
+ * @brief Forget every entry added since the table held mark entries.
+ */
+static void kfs_dedup_rollback(struct kfs_dedup *d, size_t mark)
+{
+	while (d->used > mark) {
+		struct kfs_dedup_entry *e = &d->entries[--d->used];
+
+		d->buckets[e->hash & d->mask] = e->next;
+	}
+}
+
+static u32 kfs_extent_count(const struct kfs_job *job)
+{
+	u32 cnt = 0;
+
+	for (u32 n = 0; n < job->blk_cnt; ++n)
+		if (!n || kfs_job_blk(job, n) != kfs_job_blk(job, n - 1) + 1)
+			cnt++;
+
+	return cnt;
+}
+
+/**
+ * @brief Map the blocks of a file onto identical blocks already laid out,
+ *        new blocks being allocated from job->blk_idx.
  */
-static u32
-kfs_write_inode(int romfd, int fd, struct kfs_inode *inode, u32 blk_idx)
+static void kfs_dedup_file(struct kfs_dedup *d, struct kfs_job *job)
 {
-	for (size_t i = 0; i < KFS_DIRECT_BLK; ++blk_idx, ++i) {
-		struct kfs_block blk = { 0 };
+	size_t mark = d->used;
 
-		if (!kfs_read_block(fd, &blk))
-			return blk_idx;
+	job->blk_map = calloc(job->blk_cnt, sizeof(*job->blk_map));
+	if (job->blk_cnt && !job->blk_map)
+		err(1, "unable to allocate the block map of \"%s\"", job->path);
 
-		pr_info("write direct block to offset %u\n", blk_idx * KFS_BLK_SZ);
+	job->new_cnt = 0;
+	for (u32 n = 0; n < job->blk_cnt; ++n) {
+		u64 hash = kfs_blk_hash(&job->blks[n]);
+		const struct kfs_dedup_entry *e = kfs_dedup_find(d, &job->blks[n], hash);
 
-		blk.idx = blk_idx;
-		blk.cksum = kfs_checksum(&blk, sizeof(blk));
+		if (e) {
+			job->blk_map[n] = e->idx;
+			continue;
+		}
+
+		job->blk_map[n] = job->blk_idx + job->new_cnt++;
+		kfs_dedup_add(d, &job->blks[n], hash, job->blk_map[n]);
+	}
 
-		kfs_write(romfd, &blk, sizeof(blk), blk.idx);
+	if (kfs_extent_count(job) <= KFS_EXTENT_CNT) {
+		if (job->new_cnt < job->blk_cnt)
+			pr_info("\"%s\" shares %u blocks\n", job->path,
+				job->blk_cnt - job->new_cnt);
+		return;
+	}
 
-		inode->d_blks[i] = blk.idx;
-		inode->d_blk_cnt++;
+	/* too fragmented: store the whole file again */
+	kfs_dedup_rollback(d, mark);
+	for (u32 n = 0; n < job->blk_cnt; ++n) {
+		job->blk_map[n] = job->blk_idx + n;
+		kfs_dedup_add(d, &job->blks[n], kfs_blk_hash(&job->blks[n]),
+			      job->blk_map[n]);
 	}
+	job->new_cnt = job->blk_cnt;
+}
+
+static int kfs_tail_cmp(const void *a, const void *b)
+{
+	const struct kfs_job *ja = *(const struct kfs_job **)a;
+	const struct kfs_job *jb = *(const struct kfs_job **)b;
 
-	for (size_t i = 0; i < KFS_INDIRECT_BLK; ++i) {
-		struct kfs_iblock iblock_idx = { 0 };
+	if (ja->tail_len != jb->tail_len)
+		return ja->tail_len < jb->tail_len ? 1 : -1;
+	return ja < jb ? -1 : ja > jb;
+}
 
-		pr_info("write indirect data blocks to index %zu.\n", i);
+/**
+ * @brief Pack the tails of every file in as few blocks as possible, first
+ *        fit from the largest tail, in blocks starting at blkoff.
+ * @return the number of tail blocks, built in *blks.
+ */
+static u32 kfs_pack_tails(struct kfs_job *jobs, size_t nb_files, size_t blkoff,
+			  struct kfs_block **blks)
+{
+	struct kfs_job **sorted = calloc(nb_files, sizeof(*sorted));
+	size_t nb_tails = 0;
+	u32 cnt = 0;
 
-		for (size_t j = 0; j < KFS_INDIRECT_BLK_CNT; ++blk_idx, ++j) {
-			struct kfs_block blk = { 0 };
+	*blks = calloc(nb_files, sizeof(**blks));
+	if (!sorted || !*blks)
+		err(1, "unable to allocate the tail blocks");
 
-			if (!kfs_read_block(fd, &blk))
-				break;
+	for (size_t i = 0; i < nb_files; ++i)
+		if (jobs[i].tail_len)
+			sorted[nb_tails++] = &jobs[i];
+	qsort(sorted, nb_tails, sizeof(*sorted), kfs_tail_cmp);
 
-			pr_info("writing indirect data block to offset %u\n", blk_idx * KFS_BLK_SZ);
+	for (size_t i = 0; i < nb_tails; ++i) {
+		struct kfs_job *job = sorted[i];
+		u32 b = 0;
 
-			blk.idx = blk_idx;
-			blk.cksum = kfs_checksum(&blk, sizeof(blk));
+		while (b < cnt && KFS_BLK_DATA_SZ - (*blks)[b].usage < job->tail_len)
+			b++;
+		if (b == cnt)
+			cnt++;
 
-			kfs_write(romfd, &blk, sizeof(blk), blk.idx);
+		job->tail_blk = blkoff + b;
+		job->tail_off = (*blks)[b].usage;
+		memcpy((*blks)[b].data + job->tail_off, job->tail, job->tail_len);
+		(*blks)[b].usage += job->tail_len;
+	}
 
-			iblock_idx.blks[j] = blk.idx;
-			iblock_idx.blk_cnt++;
+	if (nb_tails)
+		pr_info("packed %zu tails in %u blocks\n", nb_tails, cnt);
+
+	free(sorted);
+	return cnt;
+}
+
+/**
+ * @brief Assign data blocks to every file, starting at blkoff. Packed tails
+ *        come last, in *tail_cnt blocks built in *tails.
+ * @return the number of blocks of the image.
+ */
+static u32 kfs_layout(struct kfs_job *jobs, size_t nb_files, size_t blkoff,
+		      struct kfs_block **tails, u32 *tail_cnt)
+{
+	struct kfs_dedup d = { 0 };
+	size_t blk_idx = blkoff;
+
+	if (dedup) {
+		size_t nb_blks = 0;
+
+		for (size_t i = 0; i < nb_files; ++i)
+			nb_blks += jobs[i].blks ? jobs[i].blk_cnt : 0;
+		kfs_dedup_init(&d, nb_blks);
+	}
+
+	for (size_t i = 0; i < nb_files; ++i) {
+		struct kfs_job *job = &jobs[i];
+
+		if (job->lz && job->blk_cnt > 1)
+			job->lz_map = blk_idx++;
+
+		job->blk_idx = blk_idx;
+		job->new_cnt = job->blk_cnt;
+		if (dedup && job->blks)
+			kfs_dedup_file(&d, job);
+
+		blk_idx += job->new_cnt;
+		if (blk_idx > UINT32_MAX)
+			errx(1, "too much data to fit in kfs");
+	}
+
+	free(d.buckets);
+	free(d.entries);
+
+	*tail_cnt = kfs_pack_tails(jobs, nb_files, blk_idx, tails);
+	blk_idx += *tail_cnt;
+	if (blk_idx > UINT32_MAX)
+		errx(1, "too much data to fit in kfs");
+
+	return blk_idx;
+}
+
+/**
+ * @brief Hash every file into index_blk_cnt index blocks.
+ * @return 0 if a block got too crowded to keep probe runs short.
+ */
+static int kfs_fill_index(struct kfs_blk *index, u32 index_blk_cnt,
+			  const struct kfs_job *jobs, size_t nb_files)
+{
+	for (size_t i = 0; i < nb_files; ++i) {
+		char name[KFS_FNAME_SZ];
+		u32 hash;
+
+		kfs_copy_name(name, basename(jobs[i].path), sizeof(name));
+		hash = kfs_name_hash(name);
+
+		struct kfs_index *blk = &index[hash % index_blk_cnt].index;
+		u32 slot = hash / index_blk_cnt % KFS_INDEX_SLOTS;
+
+		if (blk->entry_cnt >= KFS_INDEX_SLOTS * 3 / 4)
+			return 0;
+
+		while (blk->entries[slot].inode_idx)
+			slot = (slot + 1) % KFS_INDEX_SLOTS;
+
+		blk->entries[slot].hash = hash;
+		blk->entries[slot].inode_idx = jobs[i].inode_idx;
+		blk->entry_cnt++;
+	}
+
+	return 1;
+}
+
+/**
+ * @brief Build the filename index, of at least min_cnt blocks.
+ * @return the index blocks, index_blk_cnt of them.
+ */
+static struct kfs_blk *
+kfs_build_index(const struct kfs_job *jobs, size_t nb_files, u32 min_cnt,
+		u32 *index_blk_cnt)
+{
+	u32 blk_cnt = align_up(nb_files, KFS_INDEX_SLOTS / 2) / (KFS_INDEX_SLOTS / 2);
+
+	for (blk_cnt = MAX(blk_cnt, min_cnt);; ++blk_cnt) {
+		struct kfs_blk *index = calloc(blk_cnt, sizeof(*index));
+
+		if (!index)
+			err(1, "unable to allocate %u index blocks", blk_cnt);
+
+		if (kfs_fill_index(index, blk_cnt, jobs, nb_files)) {
+			*index_blk_cnt = blk_cnt;
+			return index;
+		}
+
+		free(index);
+	}
+}
+
+/**
+ * @brief Write the filename index to the image, from block index_idx.
+ */
+static void kfs_write_index(struct kfs_blk *image, struct kfs_blk *index,
+			    u32 index_blk_cnt, u32 index_idx)
+{
+	for (u32 i = 0; i < index_blk_cnt; ++i) {
+		struct kfs_index *blk = &image[index_idx + i].index;
+
+		*blk = index[i].index;
+		blk->idx = index_idx + i;
+		blk->cksum = kfs_checksum(blk, sizeof(*blk) - sizeof(blk->cksum));
+	}
+}
+
+/*
+ * Update of an existing image: files with the same size and modification
+ * time as when it was built keep their inode and blocks as they are.
+ * Changed files are written to blocks appended to the image, in their old
+ * inode, while new files also get a new inode. The blocks of changed and
+ * removed files are left unused until the image is built again from
+ * scratch.
+ */
+struct kfs_update {
+	u32 blk_cnt;
+	u32 index_idx;
+	u32 index_blk_cnt;
+};
+
+/**
+ * @brief Match the files with the inodes of the image in rom_file.
+ * @return 0 if there is no image to update.
+ */
+static int kfs_update_files(struct kfs_update *up, struct kfs_job *jobs,
+			    size_t nb_files, const char *rom_file)
+{
+	struct kfs_image img;
+	size_t nb_kept = 0;
+
+	if (kfs_open(&img, rom_file) < 0)
+		return 0;
+
+	u8 *claimed = calloc(img.blk_cnt, 1);
+	if (!claimed)
+		err(1, "unable to allocate the inode map of %s", rom_file);
+
+	up->blk_cnt = img.blk_cnt;
+	up->index_idx = img.sb->index_idx;
+	up->index_blk_cnt = img.sb->index_blk_cnt;
+
+	for (size_t i = 0; i < nb_files; ++i) {
+		struct kfs_job *job = &jobs[i];
+		char name[KFS_FNAME_SZ + 1] = { 0 };
+
+		strncpy(name, basename(job->path), KFS_FNAME_SZ);
+		const struct kfs_inode *ino = kfs_lookup(&img, name);
+
+		/* a new file, or one listed twice */
+		if (!ino || claimed[ino->idx]) {
+			job->inode_idx = up->blk_cnt++;
+			continue;
 		}
-		if (!iblock_idx.blk_cnt)
+
+		claimed[ino->idx] = 1;
+		job->inode_idx = ino->idx;
+		if (ino->file_sz != job->file_sz || ino->mtime != job->mtime)
+			continue;
+
+		job->keep = 1;
+		job->blk_cnt = 0;
+		nb_kept++;
+	}
+
+	pr_info("%zu of %zu files unchanged in %s\n", nb_kept, nb_files,
+		rom_file);
+
+	free(claimed);
+	kfs_close(&img);
+	return 1;
+}
+
+
+/**
+ * @brief Read the whole file straight into the data area of its blocks,
+ *        with as few readv() calls as the kernel allows.
+ */
+static void kfs_read_file(struct kfs_job *job, struct kfs_blk *image)
+{
+	struct iovec *iov = calloc(job->blk_cnt, sizeof(*iov));
+	struct iovec *cur = iov;
+	u32 left = job->file_sz;
+	int fd = open(job->path, O_RDONLY);
+
+	if (fd < 0)
+		err(1, "unable to open \"%s\"", job->path);
+	if (job->blk_cnt && !iov)
+		err(1, "unable to allocate %u iovecs", job->blk_cnt);
+
+	for (u32 n = 0; n < job->blk_cnt; ++n) {
+		iov[n].iov_base = image[job->blk_idx + n].blk.data;
+		iov[n].iov_len = MIN(left, KFS_BLK_DATA_SZ);
+		left -= iov[n].iov_len;
+	}
+
+	for (u32 cnt = job->blk_cnt; cnt;) {
+		ssize_t rc = readv(fd, cur, MIN(cnt, (u32)IOV_MAX));
+
+		if (rc < 0)
+			err(1, "read error");
+		if (rc == 0)
+			errx(1, "\"%s\" was truncated while being read", job->path);
+
+		for (; cnt && (size_t)rc >= cur->iov_len; --cnt)
+			rc -= (cur++)->iov_len;
+		if (cnt) {
+			cur->iov_base = (u8 *)cur->iov_base + rc;
+			cur->iov_len -= rc;
+		}
+	}
+
+	free(iov);
+	close(fd);
+}
+
+/**
+ * @brief Read a whole file in memory.
+ */
+static u8 *kfs_load_file(struct kfs_job *job)
+{
+	u8 *data = malloc(job->file_sz ? job->file_sz : 1);
+	int fd = open(job->path, O_RDONLY);
+
+	if (fd < 0)
+		err(1, "unable to open \"%s\"", job->path);
+	if (!data)
+		err(1, "unable to allocate memory to load \"%s\"", job->path);
+
+	for (size_t pos = 0; pos < job->file_sz;) {
+		ssize_t rc = read(fd, data + pos, job->file_sz - pos);
+
+		if (rc < 0)
+			err(1, "read error");
+		if (rc == 0)
+			errx(1, "\"%s\" was truncated while being read", job->path);
+		pos += rc;
+	}
+
+	close(fd);
+	return data;
+}
+
+/**
+ * @brief Compress a file, if that makes it use fewer blocks.
+ */
+static void kfs_compress_file(struct kfs_job *job, const u8 *data)
+{
+	struct kfs_block *blks = calloc(KFS_LZMAP_CNT, sizeof(*blks));
+	size_t pos = 0;
+	u32 cnt = 0;
+
+	if (!blks)
+		err(1, "unable to allocate memory to compress \"%s\"", job->path);
+
+	for (; pos < job->file_sz && cnt < job->blk_cnt; ++cnt) {
+		size_t len = MIN(job->file_sz - pos, KFS_LZ_RAW_MAX);
+
+		if (cnt == KFS_LZMAP_CNT)
 			break;
 
-		iblock_idx.idx = blk_idx++;
-		iblock_idx.cksum = kfs_checksum(&iblock_idx, sizeof(iblock_idx) - sizeof(iblock_idx.cksum));
+		blks[cnt].usage = lz_compress(data + pos, &len, blks[cnt].data,
+					      sizeof(blks[cnt].data));
+		blks[cnt].usage |= KFS_BLK_LZ;
+		job->lz_raw_off[cnt] = pos;
+		pos += len;
+	}
+
+	/* an lzmap block is needed past the first block */
+	if (pos < job->file_sz || cnt + (cnt > 1) >= job->blk_cnt) {
+		free(blks);
+		return;
+	}
+
+	pr_info("compressed \"%s\" from %u to %u blocks\n", job->path,
+		job->blk_cnt, cnt);
+	job->blk_cnt = cnt;
+	job->blks = blks;
+	job->lz = 1;
+}
+
+/**
+ * @brief Split a file in plain data blocks.
+ */
+static void kfs_split_file(struct kfs_job *job, const u8 *data)
+{
+	u32 left = job->file_sz;
+
+	job->blks = calloc(job->blk_cnt ? job->blk_cnt : 1, sizeof(*job->blks));
+	if (!job->blks)
+		err(1, "unable to allocate the blocks of \"%s\"", job->path);
 
-		inode->i_blks[i] = iblock_idx.idx;
-		inode->i_blk_cnt++;
+	for (u32 n = 0; n < job->blk_cnt; ++n) {
+		struct kfs_block *blk = &job->blks[n];
 
-		kfs_write(romfd, &iblock_idx, sizeof(iblock_idx), iblock_idx.idx);
+		blk->usage = MIN(left, KFS_BLK_DATA_SZ);
+		memcpy(blk->data, data + n * KFS_BLK_DATA_SZ, blk->usage);
+		left -= blk->usage;
 	}
+}
 
-	return blk_idx;
+/**
+ * @brief Take the last, partial block of a file out of its blocks, to be
+ *        packed with other tails. A compressed file can only lose its
+ *        single block, as the blocks of an lzmap are all its own.
+ */
+static void kfs_tail_file(struct kfs_job *job)
+{
+	struct kfs_block *last;
+	u32 len;
+
+	if (!job->blk_cnt || (job->lz && job->blk_cnt > 1))
+		return;
+
+	last = &job->blks[job->blk_cnt - 1];
+	len = last->usage & ~KFS_BLK_LZ;
+	if (len == KFS_BLK_DATA_SZ)
+		return;
+
+	job->tail = last->data;
+	job->tail_len = len;
+	job->blk_cnt--;
 }
 
 /**
- * @brief Write every file to rom from blkoff offset.
+ * @brief Build the data blocks of a file in memory, for the layout to
+ *        know their number and content.
  */
-static u32
-kfs_write_files(int romfd, char **files, size_t nb_files, size_t blkoff)
+static void kfs_prepare_file(struct kfs_job *job, struct kfs_blk *image)
 {
-	size_t inode_off = blkoff;
-	size_t blk_idx = nb_files + blkoff;
+	(void)image;
 
-	for (size_t i = 0; i < nb_files; ++i, inode_off++) {
-		int fd = open(files[i], O_RDONLY);
+	if (job->keep)
+		return;
 
-		if (!fd)
-			err(1, "unable to open \"%s\"", files[i]);
+	u8 *data = kfs_load_file(job);
 
-		struct stat st;
-		fstat(fd, &st);
+	if (compress)
+		kfs_compress_file(job, data);
+	if (!job->blks && (dedup || tail))
+		kfs_split_file(job, data);
+	if (tail)
+		kfs_tail_file(job);
 
-		if (st.st_size > KFS_MAX_FILE_SZ)
-			err(1, "file \"%s\" of size %zu is too large to fit in kfs", files[i], st.st_size);
+	free(data);
+}
+
+/**
+ * @brief Write file inode & blocks to rom.
+ */
+static void kfs_write_file(struct kfs_job *job, struct kfs_blk *image)
+{
+	struct kfs_inode *inode = job->inode;
+	u32 left = job->file_sz;
+
+	if (job->keep)
+		return;
 
-		struct kfs_inode inode = {
-			.idx = inode_off,
-			.next_inode = inode_off + 1,
-			.inumber = i + 1, /* with this tool it will be the same as idx */
-			.file_sz = st.st_size,
-			.blk_cnt = align_up(st.st_size, KFS_BLK_DATA_SZ) / KFS_BLK_DATA_SZ,
-		};
+	pr_info("- writing inode %u\n", inode->inumber);
+	pr_info("writing data blocks to offset %u\n", job->blk_idx * KFS_BLK_SZ);
 
-		strncpy(inode.filename, basename(files[i]), sizeof(inode.filename));
+	if (!job->blks)
+		kfs_read_file(job, image);
 
-		/* fix last inode */
-		if (i == nb_files - 1)
-			inode.next_inode = 0;
+	for (u32 n = 0; n < job->blk_cnt; ++n) {
+		u32 blk_idx = kfs_job_blk(job, n);
+		struct kfs_block *blk = &image[blk_idx].blk;
 
-		pr_info("- writing inode %u\n", inode.inumber);
-		pr_info("writing data blocks to offset %zu\n", blk_idx * KFS_BLK_SZ);
+		/* shared with an earlier file, which writes it */
+		if (blk_idx - job->blk_idx >= job->new_cnt)
+			continue;
 
-		blk_idx = kfs_write_inode(romfd, fd, &inode, blk_idx);
+		if (job->blks) {
+			*blk = job->blks[n];
+		} else {
+			blk->usage = MIN(left, KFS_BLK_DATA_SZ);
+			left -= blk->usage;
+		}
+		blk->idx = blk_idx;
+		blk->cksum = kfs_block_checksum(blk);
+	}
 
-		inode.cksum = kfs_checksum(&inode, sizeof(inode) - sizeof(inode.cksum));
+	if (job->lz)
+		inode->flags |= KFS_INODE_LZ;
 
-		pr_info("writing inode to offset %u\n", inode.idx * KFS_BLK_SZ);
+	if (job->lz_map) {
+		struct kfs_lzmap *map = &image[job->lz_map].lzmap;
 
-		kfs_write(romfd, &inode, sizeof(inode), inode.idx);
+		map->idx = job->lz_map;
+		map->blk_cnt = job->blk_cnt;
+		memcpy(map->raw_off, job->lz_raw_off,
+		       job->blk_cnt * sizeof(*map->raw_off));
+		map->cksum = kfs_checksum(map, sizeof(*map) - sizeof(map->cksum));
 
-		close(fd);
+		inode->lz_map = job->lz_map;
 	}
 
-	return blk_idx;
+	/* one extent per run of contiguous blocks */
+	for (u32 n = 0; n < job->blk_cnt; ++n) {
+		u32 blk_idx = kfs_job_blk(job, n);
+		struct kfs_extent *e;
+
+		if (n && blk_idx == kfs_job_blk(job, n - 1) + 1) {
+			inode->extents[inode->extent_cnt - 1].blk_cnt++;
+			continue;
+		}
+
+		e = &inode->extents[inode->extent_cnt++];
+		e->start = blk_idx;
+		e->blk_cnt = 1;
+	}
+
+	inode->blk_cnt = job->blk_cnt;
+	if (job->tail_len) {
+		inode->tail_blk = job->tail_blk;
+		inode->tail_off = job->tail_off;
+		inode->tail_len = job->tail_len;
+	}
+	inode->cksum = kfs_checksum(inode, sizeof(*inode) - sizeof(inode->cksum));
+
+	free(job->blks);
+	free(job->blk_map);
+	job->blks = NULL;
+	job->blk_map = NULL;
+}
+
+struct kfs_worker {
+	void (*fn)(struct kfs_job *job, struct kfs_blk *image);
+	struct kfs_blk *image;
+	struct kfs_job *jobs;
+	size_t nb_jobs;
+	size_t next;
+};
+
+static void *kfs_worker_run(void *arg)
+{
+	struct kfs_worker *w = arg;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED)) < w->nb_jobs)
+		w->fn(&w->jobs[i], w->image);
+
+	return NULL;
+}
+
+/**
+ * @brief Run fn on every job, using nb_threads threads.
+ */
+static void kfs_run(void (*fn)(struct kfs_job *, struct kfs_blk *),
+		    struct kfs_blk *image, struct kfs_job *jobs,
+		    size_t nb_files, size_t nb_threads)
+{
+	struct kfs_worker w = {
+		.fn = fn,
+		.image = image,
+		.jobs = jobs,
+		.nb_jobs = nb_files,
+	};
+	pthread_t *threads = calloc(nb_threads, sizeof(*threads));
+
+	if (!threads)
+		err(1, "unable to allocate %zu threads", nb_threads);
+
+	nb_threads = MIN(nb_threads, nb_files);
+	for (size_t i = 1; i < nb_threads; ++i) {
+		int rc = pthread_create(&threads[i], NULL, kfs_worker_run, &w);
+
+		if (rc)
+			errx(1, "unable to create thread: %s", strerror(rc));
+	}
+
+	kfs_worker_run(&w);
+
+	for (size_t i = 1; i < nb_threads; ++i)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+}
+
+/**
+ * @brief Write every file to the image, chaining their inodes in the order
+ *        of files, using nb_threads threads. The image does not depend on
+ *        nb_threads.
+ */
+static void
+kfs_write_files(struct kfs_blk *image, struct kfs_job *jobs, size_t nb_files,
+		size_t nb_threads)
+{
+	for (size_t i = 0; i < nb_files; ++i) {
+		struct kfs_inode *inode = &image[jobs[i].inode_idx].ino;
+		u32 next = i == nb_files - 1 ? 0 : jobs[i + 1].inode_idx;
+
+		jobs[i].inode = inode;
+		if (jobs[i].keep) {
+			/* only relinked */
+			inode->next_inode = next;
+			inode->cksum = kfs_checksum(inode, sizeof(*inode) -
+						    sizeof(inode->cksum));
+			continue;
+		}
+
+		memset(&image[jobs[i].inode_idx], 0, sizeof(struct kfs_blk));
+		inode->idx = jobs[i].inode_idx;
+		inode->next_inode = next;
+		inode->inumber = inode->idx;
+		inode->file_sz = jobs[i].file_sz;
+		inode->mtime = jobs[i].mtime;
+		kfs_copy_name(inode->filename, basename(jobs[i].path),
+			      sizeof(inode->filename));
+	}
+
+	kfs_run(kfs_write_file, image, jobs, nb_files, nb_threads);
+}
+
+/**
+ * @brief Write the blocks of packed tails to the image, from blkoff.
+ */
+static void kfs_write_tails(struct kfs_blk *image, struct kfs_block *tails,
+			    u32 tail_cnt, u32 blkoff)
+{
+	for (u32 n = 0; n < tail_cnt; ++n) {
+		struct kfs_block *blk = &image[blkoff + n].blk;
+
+		*blk = tails[n];
+		blk->idx = blkoff + n;
+		blk->cksum = kfs_block_checksum(blk);
+	}
 }
 
 static inline void usage(void)
 {
 	extern const char *__progname;
 
-	fprintf(stderr, "usage: %s [-v] [-n name] -o rom_file files...\n",
+	fprintf(stderr, "usage: %s [-dtuvz] [-j jobs] [-n name] -o rom_file files...\n",
 		__progname);
 
 	exit(1);
@@ -228,19 +902,37 @@ int main(int argc, char **argv)
 {
 	char *rom_file = NULL;
 	char *rom_name = NULL;
+	long nb_threads = 1;
 	int opt;
 
-	while ((opt = getopt(argc, argv, "n:o:v")) != -1) {
+	while ((opt = getopt(argc, argv, "dj:n:o:tuvz")) != -1) {
 		switch (opt) {
+		case 'd':
+			dedup = 1;
+			break;
+		case 'j':
+			nb_threads = strtol(optarg, NULL, 10);
+			if (nb_threads < 1)
+				usage();
+			break;
 		case 'n':
 			rom_name = optarg;
 			break;
 		case 'o':
 			rom_file = optarg;
 			break;
+		case 't':
+			tail = 1;
+			break;
+		case 'u':
+			update = 1;
+			break;
 		case 'v':
 			verbose = 1;
 			break;
+		case 'z':
+			compress = 1;
+			break;
 		default:
 			usage();
 			break;
@@ -262,16 +954,71 @@ int main(int argc, char **argv)
 	if (!rom_name)
 		rom_name = rom_file;
 
-	int romfd = open(rom_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	struct kfs_job *jobs = calloc(nb_files, sizeof(*jobs));
+	if (!jobs)
+		err(1, "unable to allocate %zu jobs", nb_files);
+
+	kfs_stat_files(jobs, files, nb_files);
+
+	/* superblock, inodes, filename index, then file data */
+	struct kfs_update up = { 0 };
+	if (!update || !kfs_update_files(&up, jobs, nb_files, rom_file)) {
+		update = 0;
+		for (size_t i = 0; i < nb_files; ++i)
+			jobs[i].inode_idx = 1 + i;
+		up.blk_cnt = 1 + nb_files;
+	}
+
+	/* the old index is rewritten in place if it is still large enough */
+	u32 index_blk_cnt;
+	struct kfs_blk *index = kfs_build_index(jobs, nb_files,
+						up.index_blk_cnt,
+						&index_blk_cnt);
+	u32 index_idx = up.index_idx;
+	if (index_blk_cnt != up.index_blk_cnt) {
+		index_idx = up.blk_cnt;
+		up.blk_cnt += index_blk_cnt;
+	}
+
+	if (compress || dedup || tail)
+		kfs_run(kfs_prepare_file, NULL, jobs, nb_files, nb_threads);
+
+	struct kfs_block *tails;
+	u32 tail_cnt;
+	u32 blk_cnt = kfs_layout(jobs, nb_files, up.blk_cnt, &tails, &tail_cnt);
+	size_t rom_sz = (size_t)blk_cnt * KFS_BLK_SZ;
+
+	int romfd = open(rom_file, O_RDWR | O_CREAT | (update ? 0 : O_TRUNC),
+			 0666);
 	if (romfd < 0)
 		err(1, "unable to open %s", rom_file);
 
+	/* the image is built in place: every new block starts out zeroed */
+	if (ftruncate(romfd, rom_sz) < 0)
+		err(1, "unable to resize %s", rom_file);
+
+	struct kfs_blk *image = mmap(NULL, rom_sz, PROT_READ | PROT_WRITE,
+				     MAP_SHARED, romfd, 0);
+	if (image == MAP_FAILED)
+		err(1, "unable to map %s", rom_file);
+
 	pr_info("block size: %u\n", KFS_BLK_SZ);
 	pr_info("%zu inodes will be written.\n", nb_files);
 
-	u32 blk_cnt = kfs_write_files(romfd, files, nb_files, 1);
+	kfs_write_files(image, jobs, nb_files, nb_threads);
+	kfs_write_tails(image, tails, tail_cnt, blk_cnt - tail_cnt);
+	kfs_write_index(image, index, index_blk_cnt, index_idx);
+
+	kfs_write_superblock(image, rom_name, blk_cnt, jobs[0].inode_idx,
+			     nb_files, index_idx, index_blk_cnt);
+
+	if (munmap(image, rom_sz) < 0)
+		err(1, "unable to write %s", rom_file);
 
-	kfs_write_superblock(romfd, rom_name, blk_cnt, nb_files);
+	free(index);
+	free(tails);
+	free(jobs);
+	close(romfd);
 
 	return 0;
 }
@@ -0,0 +1,218 @@
+#include <elf.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <k/romz.h>
+
+#include "lz.h"
+
+/* chunks smaller than that are not worth starting before a page end */
+#define ROMZ_CHUNK_MIN 64
+
+static int verbose;
+
+struct romz_out {
+	u8 *buf;
+	size_t len;
+	size_t cap;
+};
+
+static void romz_append(struct romz_out *out, const void *data, size_t len)
+{
+	if (out->len + len > out->cap) {
+		out->cap = MAX(2 * out->cap, out->len + len);
+		out->buf = realloc(out->buf, out->cap);
+		if (!out->buf)
+			err(1, "unable to allocate %zu bytes", out->cap);
+	}
+
+	memcpy(out->buf + out->len, data, len);
+	out->len += len;
+}
+
+/**
+ * @brief Zero fill up to the next page, where the segment goes on.
+ */
+static void romz_pad(struct romz_out *out)
+{
+	static const u8 zeroes[ROMZ_PAGE_SZ];
+	size_t room = ROMZ_PAGE_SZ - out->len % ROMZ_PAGE_SZ;
+
+	romz_append(out, zeroes, room);
+}
+
+/**
+ * @brief Compress len bytes of segment data as chunks that each fit in
+ *        what is left of a page.
+ */
+static void romz_write_segment(struct romz_out *out, const u8 *data,
+			       size_t len)
+{
+	static u8 buf[ROMZ_PAGE_SZ];
+
+	while (len) {
+		size_t room = ROMZ_PAGE_SZ - out->len % ROMZ_PAGE_SZ;
+		struct romz_chunk chunk;
+
+		if (room < sizeof(chunk) + ROMZ_CHUNK_MIN) {
+			romz_pad(out);
+			continue;
+		}
+
+		size_t raw_len = MIN(len, ROMZ_CHUNK_RAW_MAX);
+		size_t clen = lz_compress(data, &raw_len, buf,
+					  room - sizeof(chunk));
+		if (!raw_len) {
+			romz_pad(out);
+			continue;
+		}
+
+		chunk.raw_len = raw_len;
+		chunk.len = clen;
+		romz_append(out, &chunk, sizeof(chunk));
+		romz_append(out, buf, clen);
+
+		data += raw_len;
+		len -= raw_len;
+	}
+}
+
+static void romz_check_ehdr(const char *file, const Elf32_Ehdr *ehdr,
+			    size_t size)
+{
+	if (size < sizeof(*ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+	    ehdr->e_ident[EI_CLASS] != ELFCLASS32 ||
+	    ehdr->e_ident[EI_DATA] != ELFDATA2LSB ||
+	    ehdr->e_type != ET_EXEC || ehdr->e_machine != EM_386)
+		errx(1, "%s: not an i386 executable", file);
+
+	if (ehdr->e_phentsize != sizeof(Elf32_Phdr) ||
+	    ehdr->e_phoff > size ||
+	    ehdr->e_phnum * sizeof(Elf32_Phdr) > size - ehdr->e_phoff)
+		errx(1, "%s: invalid program headers", file);
+}
+
+/**
+ * @brief Build the container of the PT_LOAD segments of an ELF.
+ */
+static void romz_build(struct romz_out *out, const char *file,
+		       const u8 *elf, size_t size)
+{
+	const Elf32_Ehdr *ehdr = (const Elf32_Ehdr *)elf;
+	struct romz_header hdr = {
+		.magic = ROMZ_MAGIC,
+	};
+
+	romz_check_ehdr(file, ehdr, size);
+	hdr.entry = ehdr->e_entry;
+
+	/* the header is written last, once the segments are laid out */
+	romz_append(out, &hdr, sizeof(hdr));
+
+	const Elf32_Phdr *phdrs = (const Elf32_Phdr *)(elf + ehdr->e_phoff);
+	for (size_t i = 0; i < ehdr->e_phnum; ++i) {
+		const Elf32_Phdr *phdr = &phdrs[i];
+
+		if (phdr->p_type == PT_DYNAMIC && phdr->p_filesz)
+			hdr.dynamic = phdr->p_vaddr;
+		if (phdr->p_type != PT_LOAD)
+			continue;
+		if (hdr.seg_cnt == ROMZ_SEG_MAX)
+			errx(1, "%s: more than %d segments", file,
+			     ROMZ_SEG_MAX);
+		if (phdr->p_offset > size ||
+		    phdr->p_filesz > size - phdr->p_offset ||
+		    phdr->p_filesz > phdr->p_memsz)
+			errx(1, "%s: invalid segment %zu", file, i);
+
+		struct romz_segment *seg = &hdr.segs[hdr.seg_cnt++];
+		seg->vaddr = phdr->p_vaddr;
+		seg->filesz = phdr->p_filesz;
+		seg->memsz = phdr->p_memsz;
+		seg->offset = out->len;
+
+		romz_write_segment(out, elf + phdr->p_offset, phdr->p_filesz);
+		seg->size = out->len - seg->offset;
+
+		if (verbose)
+			printf("[+] segment %#x: %u -> %u bytes\n",
+			       seg->vaddr, seg->filesz, seg->size);
+	}
+
+	if (!hdr.seg_cnt)
+		errx(1, "%s: no segment to load", file);
+
+	memcpy(out->buf, &hdr, sizeof(hdr));
+}
+
+static inline void usage(void)
+{
+	extern const char *__progname;
+
+	fprintf(stderr, "usage: %s [-v] -o rom_file elf_file\n", __progname);
+
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	char *rom_file = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:v")) != -1) {
+		switch (opt) {
+		case 'o':
+			rom_file = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (optind != argc - 1 || !rom_file)
+		usage();
+
+	const char *elf_file = argv[optind];
+	int fd = open(elf_file, O_RDONLY);
+	if (fd < 0)
+		err(1, "unable to open %s", elf_file);
+
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		err(1, "unable to stat %s", elf_file);
+
+	const u8 *elf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (elf == MAP_FAILED)
+		err(1, "unable to map %s", elf_file);
+	close(fd);
+
+	struct romz_out out = { 0 };
+	romz_build(&out, elf_file, elf, st.st_size);
+
+	if (verbose)
+		printf("[+] %s: %zu -> %zu bytes\n", elf_file,
+		       (size_t)st.st_size, out.len);
+
+	fd = open(rom_file, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+	if (fd < 0)
+		err(1, "unable to open %s", rom_file);
+	if (write(fd, out.buf, out.len) != (ssize_t)out.len)
+		err(1, "unable to write %s", rom_file);
+	close(fd);
+
+	munmap((void *)elf, st.st_size);
+	free(out.buf);
+
+	return 0;
+}